@@ -0,0 +1,246 @@
+#include "NesBatchEnvironment.h"
+#include "NesThread.h"
+#include "EmuCore/api/NstApiCheats.hpp"
+#include "Async/ParallelFor.h"
+#include "Misc/FileHelper.h"
+
+#include <sstream>
+
+FNesBatchEnvironment::FNesBatchEnvironment(const FNesBatchSettings& InSettings) :
+	Settings(InSettings)
+{
+	Settings.NumEnvironments = FMath::Max(Settings.NumEnvironments, 1);
+	Settings.FrameSkip = FMath::Max(Settings.FrameSkip, 1);
+
+	for (FNesRewardAddress& RewardAddress : Settings.RewardAddresses)
+	{
+		RewardAddress.NumBytes = FMath::Clamp(RewardAddress.NumBytes, 1, 4);
+		if (RewardAddress.Address + RewardAddress.NumBytes > Nes::Cheats::RAM_SIZE)
+		{
+			UE_LOG(LogUEnesTiming, Error, TEXT("Batch environment reward address $%04X (%d bytes) is outside CPU RAM, only $0000-$07FF can be read"), RewardAddress.Address, RewardAddress.NumBytes);
+			return;
+		}
+	}
+
+	TArray<uint8> RomData;
+	if (!FFileHelper::LoadFileToArray(RomData, *Settings.RomPath))
+	{
+		UE_LOG(LogUEnesTiming, Error, TEXT("Batch environment could not read %s"), *Settings.RomPath);
+		return;
+	}
+
+	const string Rom(reinterpret_cast<const char*>(RomData.GetData()), RomData.Num());
+
+	for (int32 i = 0; i < Settings.NumEnvironments; i++)
+	{
+		TUniquePtr<FEnvironment> Environment = MakeUnique<FEnvironment>();
+		istringstream RomStream(Rom, ios::binary);
+
+		if (NES_FAILED(FEmulatorThreaded::LoadHeadless(Environment->Emulator, RomStream)))
+		{
+			UE_LOG(LogUEnesTiming, Error, TEXT("Batch environment could not load %s"), *Settings.RomPath);
+			UnloadAll();
+			return;
+		}
+
+		FEmulatorThreaded::ApplyRenderState(Environment->Emulator, ScreenSettings);
+
+		Environment->Frame.SetNumZeroed(ScreenSettings.ScreenWidth * ScreenSettings.ScreenHeight * 4);
+		Environment->VideoOutput.pixels = Environment->Frame.GetData();
+		Environment->VideoOutput.pitch = ScreenSettings.ScreenWidth * 4;
+		Environment->RewardValues.SetNumZeroed(Settings.RewardAddresses.Num());
+
+		Environments.Add(MoveTemp(Environment));
+	}
+
+	// Every environment starts from the state the first one reaches after warming up
+	for (int32 Frame = 0; Frame < Settings.WarmupFrames; Frame++)
+	{
+		Environments[0]->Emulator.Execute(&Environments[0]->VideoOutput, NULL, &Environments[0]->Input);
+	}
+
+	FEmulatorThreaded::SaveStateToArray(Environments[0]->Emulator, Snapshot, Nes::Machine::NO_COMPRESSION);
+	SnapshotFrame = Environments[0]->Frame;
+
+	TArray<int32> AllEnvironments;
+	for (int32 i = 0; i < Environments.Num(); i++)
+	{
+		AllEnvironments.Add(i);
+	}
+
+	Reset(AllEnvironments, nullptr);
+}
+
+FNesBatchEnvironment::~FNesBatchEnvironment()
+{
+	if (NumSteps > 0)
+	{
+		UE_LOG(LogUEnesTiming, Log, TEXT("Batch environment ran %lld steps of %d environments, %.0f environment steps/sec"), NumSteps, Environments.Num(), GetStepsPerSecond());
+	}
+
+	UnloadAll();
+}
+
+void FNesBatchEnvironment::UnloadAll()
+{
+	// Unloading fires the static callbacks, so it can't be left to the emulators' destructors
+	for (TUniquePtr<FEnvironment>& Environment : Environments)
+	{
+		FEmulatorThreaded::UnloadHeadless(Environment->Emulator);
+	}
+
+	Environments.Empty();
+}
+
+int32 FNesBatchEnvironment::GetObservationSize() const
+{
+	int32 Size = Settings.bObserveRam ? Nes::Cheats::RAM_SIZE : 0;
+
+	if (Settings.DownsampleFactor > 0)
+	{
+		Size += FMath::DivideAndRoundUp(ScreenSettings.ScreenWidth, Settings.DownsampleFactor) * FMath::DivideAndRoundUp(ScreenSettings.ScreenHeight, Settings.DownsampleFactor);
+	}
+
+	return Size;
+}
+
+double FNesBatchEnvironment::GetStepsPerSecond() const
+{
+	return StepSeconds > 0 ? NumSteps * Environments.Num() / StepSeconds : 0;
+}
+
+void FNesBatchEnvironment::Step(const uint8* Actions, uint8* Observations, float* Rewards)
+{
+	const double StartTime = FPlatformTime::Seconds();
+	const int32 ObservationSize = GetObservationSize();
+
+	// Environments share nothing while running frames, so they are sharded across the task graph's workers
+	ParallelFor(Environments.Num(), [&](int32 Index)
+		{
+			FEnvironment& Environment = *Environments[Index];
+
+			RunFrames(Environment, Actions ? Actions[Index] : 0);
+
+			if (Observations)
+			{
+				WriteObservation(Environment, Observations + Index * ObservationSize);
+			}
+
+			const float Reward = UpdateReward(Environment);
+			if (Rewards)
+			{
+				Rewards[Index] = Reward;
+			}
+		});
+
+	NumSteps++;
+	StepSeconds += FPlatformTime::Seconds() - StartTime;
+}
+
+void FNesBatchEnvironment::Reset(const TArray<int32>& EnvironmentIndices, uint8* Observations)
+{
+	const int32 ObservationSize = GetObservationSize();
+
+	for (int32 Index : EnvironmentIndices)
+	{
+		if (!Environments.IsValidIndex(Index))
+		{
+			continue;
+		}
+
+		FEnvironment& Environment = *Environments[Index];
+		FEmulatorThreaded::LoadStateHeadless(Environment.Emulator, Snapshot);
+
+		// Save states don't include the rendered frame
+		FMemory::Memcpy(Environment.Frame.GetData(), SnapshotFrame.GetData(), SnapshotFrame.Num());
+
+		// Start counting rewards from the restored values
+		UpdateReward(Environment);
+
+		if (Observations)
+		{
+			WriteObservation(Environment, Observations + Index * ObservationSize);
+		}
+	}
+}
+
+bool FNesBatchEnvironment::CaptureSnapshot(int32 EnvironmentIndex)
+{
+	if (!Environments.IsValidIndex(EnvironmentIndex))
+	{
+		return false;
+	}
+
+	FEnvironment& Environment = *Environments[EnvironmentIndex];
+	if (NES_FAILED(FEmulatorThreaded::SaveStateToArray(Environment.Emulator, Snapshot, Nes::Machine::NO_COMPRESSION)))
+	{
+		return false;
+	}
+
+	SnapshotFrame = Environment.Frame;
+	return true;
+}
+
+void FNesBatchEnvironment::RunFrames(FEnvironment& Environment, uint8 Action)
+{
+	Environment.Input.pad[0].buttons = Action;
+
+	for (int32 Frame = 0; Frame < Settings.FrameSkip; Frame++)
+	{
+		// Only the frame that is observed needs to be rendered, sound is never rendered
+		const bool bRenderVideo = Settings.DownsampleFactor > 0 && Frame == Settings.FrameSkip - 1;
+		Environment.Emulator.Execute(bRenderVideo ? &Environment.VideoOutput : NULL, NULL, &Environment.Input);
+	}
+}
+
+void FNesBatchEnvironment::WriteObservation(FEnvironment& Environment, uint8* Observation) const
+{
+	if (Settings.DownsampleFactor > 0)
+	{
+		const int32 Pitch = ScreenSettings.ScreenWidth * 4;
+
+		for (int32 Y = 0; Y < ScreenSettings.ScreenHeight; Y += Settings.DownsampleFactor)
+		{
+			const uint8* Row = Environment.Frame.GetData() + Y * Pitch;
+			for (int32 X = 0; X < ScreenSettings.ScreenWidth; X += Settings.DownsampleFactor)
+			{
+				// Rec. 601 luma in 8.8 fixed point
+				const uint8* Pixel = Row + X * 4;
+				*Observation++ = (Pixel[0] * 77 + Pixel[1] * 150 + Pixel[2] * 29) >> 8;
+			}
+		}
+	}
+
+	if (Settings.bObserveRam)
+	{
+		FMemory::Memcpy(Observation, Nes::Cheats(Environment.Emulator).GetRam(), Nes::Cheats::RAM_SIZE);
+	}
+}
+
+int64 FNesBatchEnvironment::ReadRewardValue(FEnvironment& Environment, const FNesRewardAddress& RewardAddress) const
+{
+	Nes::Cheats::Ram Ram = Nes::Cheats(Environment.Emulator).GetRam();
+	int64 Value = 0;
+
+	// The constructor made sure every byte is inside CPU RAM
+	for (int32 i = RewardAddress.NumBytes - 1; i >= 0; i--)
+	{
+		Value = (Value << 8) | Ram[RewardAddress.Address + i];
+	}
+
+	return Value;
+}
+
+float FNesBatchEnvironment::UpdateReward(FEnvironment& Environment) const
+{
+	float Reward = 0.f;
+
+	for (int32 i = 0; i < Settings.RewardAddresses.Num(); i++)
+	{
+		const int64 Value = ReadRewardValue(Environment, Settings.RewardAddresses[i]);
+		Reward += Settings.RewardAddresses[i].Scale * (Value - Environment.RewardValues[i]);
+		Environment.RewardValues[i] = Value;
+	}
+
+	return Reward;
+}
@@ -1,19 +1,29 @@
 #include "NesComponent.h"
 #include "UEnes.h"
 #include "NesThread.h"
+#include "NesScreenSubsystem.h"
+#include "NesEmulatorPoolSubsystem.h"
 #include "ImageUtils.h"
 #include "AudioMixerTypes.h"
 #include "GenericPlatform/GenericPlatformProperties.h"
 #include "EmuCore/NstBase.hpp"
 #include "Async/TaskGraphInterfaces.h"
+#include "TimerManager.h"
+#include "ProfilingDebugging/CpuProfilerTrace.h"
 
-void UNesComponent::FrameReadyCallback(const TArray<uint8>& VideoData, const TArray<uint8>& AudioData, int32 AudioByteCount)
+DECLARE_CYCLE_STAT(TEXT("Frame Ready"), STAT_NesFrameReady, STATGROUP_UEnes);
+DECLARE_CYCLE_STAT(TEXT("Queue Audio"), STAT_NesQueueAudio, STATGROUP_UEnes);
+
+void UNesComponent::FrameReadyCallback(const FNesStagingPoolPtr& Pool, int32 BufferIndex, const FNesDirtyRows& DirtyRows, const TArray<uint8>& AudioData, const TArray<uint8>& RamData, int32 AudioByteCount)
 {
 	if (!IsValid(this))
 	{
 		return;
 	}
 
+	SCOPE_CYCLE_COUNTER(STAT_NesFrameReady);
+	TRACE_CPUPROFILER_EVENT_SCOPE_TEXT(*FrameReadyTraceName);
+
 	if (EmulationTickThread != nullptr)
 	{
 #if NES_SYNC_THREADS
@@ -33,8 +43,43 @@ void UNesComponent::FrameReadyCallback(const TArray<uint8>& VideoData, const TAr
 			AudioBuffer.Enqueue(AudioData[i]);
 		}
 #endif	
-		// Copy video buffer
-		FMemory::Memcpy(VideoBuffer.GetData(), VideoData.GetData(), VideoBuffer.Num());
+		// The emulator wrote the frame into one of the uploader's staging buffers, BufferIndex is INDEX_NONE if none was free
+		bool bPresented = false;
+		if (BufferIndex != INDEX_NONE)
+		{
+			if (Pool == ScreenUploader->GetStagingPool())
+			{
+				if (SharedScreenSlice != INDEX_NONE)
+				{
+					GetWorld()->GetSubsystem<UNesScreenSubsystem>()->SubmitFrame(SharedScreenSlice, Pool, BufferIndex, DirtyRows);
+					bPresented = true;
+				}
+				else
+				{
+					bPresented = ScreenUploader->UploadFrame(ScreenTexture, BufferIndex, DirtyRows);
+				}
+			}
+			else
+			{
+				// Emulated before the screen format changed. The rows of this frame are lost, have the emulator send the whole screen again
+				Pool->Release(BufferIndex);
+				EmulationTickThread->MarkAllRowsDirty();
+			}
+		}
+
+		if (RamSearch.IsValid() && RamData.Num() == FNesRamSearch::RamSize)
+		{
+			RamSearch->Update(RamData.GetData());
+		}
+
+		if (bPresented)
+		{
+			NumFramesPresented++;
+		}
+		else
+		{
+			NumFramesSkipped++;
+		}
 
 #if NES_SYNC_THREADS
 		// Let the NES thread know we've consumed the data
@@ -50,6 +95,12 @@ void UNesComponent::FrameReadyCallback(const TArray<uint8>& VideoData, const TAr
 	FrameNumber++;
 	PostExecuteFrame(AudioByteCount);
 
+	if (PlayRequestTime > 0)
+	{
+		UE_LOG(LogUEnesTiming, Verbose, TEXT("%s first frame presented %.2f ms after play"), *GetName(), (FPlatformTime::Seconds() - PlayRequestTime) * 1000.0);
+		PlayRequestTime = 0;
+	}
+
 #if !UE_BUILD_SHIPPING
 	if (FrameNumber % 20 == 0)
 	{
@@ -58,39 +109,119 @@ void UNesComponent::FrameReadyCallback(const TArray<uint8>& VideoData, const TAr
 #endif
 }
 
-void UNesComponent::CreateScreenTexture()
+void UNesComponent::CreateScreenTexture(bool bIndexed)
 {
-	// TODO Make a UTextureRenderTarget2D
-	ScreenTexture = UTexture2D::CreateTransient(NesSettings.ScreenWidth, NesSettings.ScreenHeight, EPixelFormat::PF_R8G8B8A8, FName(TEXT("ScreenTexture") + FGuid::NewGuid().ToString()));
+	ReleaseSharedScreenSlice();
+	bScreenTextureIndexed = bIndexed;
+
+	// The uploader also owns the staging buffers frames arrive in for the shared array path
+	ScreenUploader = MakeUnique<FNesScreenUploader>(NesSettings.ScreenWidth, NesSettings.ScreenHeight, bIndexed ? sizeof(uint16) : 4);
+	if (EmulationTickThread != nullptr)
+	{
+		EmulationTickThread->SetStagingPool(ScreenUploader->GetStagingPool());
+	}
+
+	if (bUseSharedScreenArray)
+	{
+		if (UNesScreenSubsystem* ScreenSubsystem = GetWorld()->GetSubsystem<UNesScreenSubsystem>())
+		{
+			SharedScreenSlice = ScreenSubsystem->AcquireSlice(NesSettings.ScreenWidth, NesSettings.ScreenHeight, bIndexed);
+			if (SharedScreenSlice != INDEX_NONE)
+			{
+				SharedScreenTexture = ScreenSubsystem->GetScreenArray();
+				ScreenTexture = nullptr;
+				return;
+			}
+		}
+
+		UE_LOG(LogUEnesVideo, Warning, TEXT("%s could not get a shared screen slice, using its own texture"), *GetName());
+	}
+
+	const EPixelFormat PixelFormat = bIndexed ? EPixelFormat::PF_R16_UINT : EPixelFormat::PF_R8G8B8A8;
+
+	ScreenTexture = UTexture2D::CreateTransient(NesSettings.ScreenWidth, NesSettings.ScreenHeight, PixelFormat, FName(TEXT("ScreenTexture") + FGuid::NewGuid().ToString()));
 	ScreenTexture->Filter = TextureFilter::TF_Nearest;
-	ScreenTexture->SRGB = true;
+	ScreenTexture->SRGB = !bIndexed;
 	ScreenTexture->LODGroup = TextureGroup::TEXTUREGROUP_UI;
 	ScreenTexture->UpdateResource();
 }
 
+void UNesComponent::ReleaseSharedScreenSlice()
+{
+	if (SharedScreenSlice != INDEX_NONE)
+	{
+		if (UNesScreenSubsystem* ScreenSubsystem = GetWorld()->GetSubsystem<UNesScreenSubsystem>())
+		{
+			ScreenSubsystem->ReleaseSlice(SharedScreenSlice);
+		}
+
+		SharedScreenSlice = INDEX_NONE;
+		SharedScreenTexture = nullptr;
+	}
+}
+
+UMaterialInterface* UNesComponent::GetScreenMaterial(UMaterialInterface* RGBAMaterial) const
+{
+	return bScreenTextureIndexed ? IndexedScreenMaterial : RGBAMaterial;
+}
+
+void UNesComponent::UpdatePaletteTexture(const TArray<FColor>& Colors)
+{
+	if (PaletteTexture == nullptr)
+	{
+		PaletteTexture = UTexture2D::CreateTransient(Colors.Num(), 1, EPixelFormat::PF_B8G8R8A8, FName(TEXT("PaletteTexture") + FGuid::NewGuid().ToString()));
+		PaletteTexture->Filter = TextureFilter::TF_Nearest;
+		PaletteTexture->SRGB = true;
+		PaletteTexture->LODGroup = TextureGroup::TEXTUREGROUP_UI;
+		PaletteTexture->UpdateResource();
+	}
+
+	// The region and data have to outlive the render command, they are freed by the cleanup callback
+	FUpdateTextureRegion2D* Region = new FUpdateTextureRegion2D(0, 0, 0, 0, Colors.Num(), 1);
+	uint8* ColorData = new uint8[Colors.Num() * sizeof(FColor)];
+	FMemory::Memcpy(ColorData, Colors.GetData(), Colors.Num() * sizeof(FColor));
+
+	PaletteTexture->UpdateTextureRegions(0, 1, Region, Colors.Num() * sizeof(FColor), sizeof(FColor), ColorData, [](uint8* SrcData, const FUpdateTextureRegion2D* Regions)
+		{
+			delete[] SrcData;
+			delete Regions;
+		});
+}
+
 void UNesComponent::BeginPlay()
 {
 	Super::BeginPlay();
 	
 	// Determine audio parameters
-	NesSettings.SampleRate = FAudioPlatformSettings::GetPlatformSettings(FPlatformProperties::GetRuntimeSettingsClassName()).SampleRate;
-	NesSettings.SamplesPerFrame = FMath::RoundToInt32((double)NesSettings.SampleRate / (double)NesSettings.FramesPerSecond);
+	NesSettings.InitializeAudioSettings();
+
+	FrameReadyTraceName = FString::Printf(TEXT("UEnes Frame Ready %s"), *GetName());
 
 	// Create buffers
-	// Video buffer is 32 bits per pixel
-	VideoBuffer.SetNum(NesSettings.ScreenWidth * NesSettings.ScreenHeight * 4);
 #if !NES_USE_AUDIO_QUEUE
-	// Audio buffer is 2 bytes per sample
-	AudioBuffer.SetNum(NesSettings.SamplesPerFrame * 2);
+	// Audio buffer is one float per sample and channel
+	AudioBuffer.SetNum(NesSettings.SamplesPerFrame * NesSettings.GetNumAudioChannels() * sizeof(float));
 #endif
 
-	CreateScreenTexture();
+	if (NesSettings.bIndexedVideo && IndexedScreenMaterial == nullptr)
+	{
+		UE_LOG(LogUEnesVideo, Warning, TEXT("%s has bIndexedVideo set but no IndexedScreenMaterial to decode it, using RGBA video"), *GetName());
+		NesSettings.bIndexedVideo = false;
+	}
+
+	CreateScreenTexture(NesSettings.bIndexedVideo);
 	NesSoundStream = NewObject<UNesSoundStream>();
+	NesSoundStream->SetNumChannels(NesSettings.GetNumAudioChannels());
+	NesSoundStream->SetSampleRate(NesSettings.SampleRate);
+
+	GetWorld()->GetTimerManager().SetTimer(HibernationTimerHandle, this, &UNesComponent::UpdateHibernation, 0.25f, true);
 }
 
 void UNesComponent::EndPlay(const EEndPlayReason::Type EndPlayReason)
 {
 	Super::EndPlay(EndPlayReason);
+
+	GetWorld()->GetTimerManager().ClearTimer(HibernationTimerHandle);
 	
 	PowerOff();
 
@@ -99,10 +230,16 @@ void UNesComponent::EndPlay(const EEndPlayReason::Type EndPlayReason)
 		delete EmulationTickThread;
 		EmulationTickThread = nullptr;
 	}
+
+	ReleaseSharedScreenSlice();
 }
 
 void UNesComponent::PowerOff()
 {
+	bHibernating = false;
+	HibernatedState.Empty();
+	CurrentGamePath.Empty();
+
 	if (EmulationTickThread != nullptr)
 	{
 		EmulationTickThread->PowerOff();
@@ -116,16 +253,134 @@ void UNesComponent::PowerOff()
 
 void UNesComponent::PlayFromFile(FString FileName)
 {
+	bHibernating = false;
+	HibernatedState.Empty();
+
+	StartEmulation(FileName, nullptr);
+}
+
+void UNesComponent::StartEmulation(const FString& FileName, const TArray<uint8>* InitialState)
+{
+	CurrentGamePath = FileName;
+
 	NesSoundStream->SetSampleRate(NesSettings.SampleRate);
-	NesSoundStream->StreamGameAudio(NesSettings.SamplesPerFrame);
+	NesSoundStream->StreamGameAudio(NesSettings.SamplesPerFrame, NesSettings.GetNumAudioChannels());
 	NesSoundStream->ResetAudio();
 
+	PlayRequestTime = FPlatformTime::Seconds();
+
 	if (EmulationTickThread == nullptr)
 	{
-		EmulationTickThread = new FEmulatorThreaded(this, NesSettings);
+		if (UNesEmulatorPoolSubsystem* EmulatorPool = GetWorld()->GetSubsystem<UNesEmulatorPoolSubsystem>())
+		{
+			EmulationTickThread = EmulatorPool->Checkout(this, NesSettings);
+		}
+
+		if (EmulationTickThread == nullptr)
+		{
+			EmulationTickThread = new FEmulatorThreaded(this, NesSettings);
+		}
+
+		// FramesRun starts over with the new emulator, keep the other counters in step so their ratios stay meaningful
+		NumFramesPresented = 0;
+		NumFramesSkipped = 0;
 	}
 
-	EmulationTickThread->PlayFromFile(FileName);
+	EmulationTickThread->SetStagingPool(ScreenUploader->GetStagingPool());
+	EmulationTickThread->bCaptureRam = RamSearch.IsValid();
+	EmulationTickThread->ClearCheatCodes();
+	for (const FCheatCode& Cheat : ActiveCheats)
+	{
+		EmulationTickThread->AddCheatCode(Cheat.Address, Cheat.Value);
+	}
+
+	EmulationTickThread->PlayFromFile(FileName, InitialState);
+
+	// The core may refuse the index encoding palette, in which case frames arrive as RGBA
+	if (EmulationTickThread->IsVideoIndexed() != bScreenTextureIndexed)
+	{
+		CreateScreenTexture(EmulationTickThread->IsVideoIndexed());
+	}
+
+	// The palette only changes when a game is loaded, so it is uploaded here rather than with every frame
+	if (EmulationTickThread->IsVideoIndexed())
+	{
+		UpdatePaletteTexture(EmulationTickThread->GetPaletteColors());
+	}
+}
+
+bool UNesComponent::Hibernate()
+{
+	// A powered off machine has no state worth keeping, and resuming it would power the game back on
+	if (bHibernating || EmulationTickThread == nullptr || !EmulationTickThread->IsRunning() || CurrentGamePath.IsEmpty())
+	{
+		return false;
+	}
+
+	const double StartTime = FPlatformTime::Seconds();
+
+	EmulationTickThread->StopThread();
+
+	// If the state can't be saved the game restarts from power on when resumed
+	if (!EmulationTickThread->SaveMachineState(HibernatedState))
+	{
+		HibernatedState.Empty();
+	}
+
+	FMemory::Memcpy(HibernatedPadButtons, EmulationTickThread->PadButtons, sizeof(HibernatedPadButtons));
+
+	// The destructor powers the machine off under the core lock, with the battery callbacks pointing at this emulator
+	delete EmulationTickThread;
+	EmulationTickThread = nullptr;
+
+	// FramesRun reads 0 without an emulator
+	NumFramesPresented = 0;
+	NumFramesSkipped = 0;
+
+	NesSoundStream->ResetAudio();
+	bHibernating = true;
+
+	UE_LOG(LogUEnesTiming, Verbose, TEXT("%s hibernated in %.2f ms, state is %d bytes"), *GetName(), (FPlatformTime::Seconds() - StartTime) * 1000.0, HibernatedState.Num());
+	return true;
+}
+
+bool UNesComponent::Resume()
+{
+	if (!bHibernating)
+	{
+		return false;
+	}
+
+	const double StartTime = FPlatformTime::Seconds();
+	bHibernating = false;
+
+	StartEmulation(CurrentGamePath, HibernatedState.Num() > 0 ? &HibernatedState : nullptr);
+	FMemory::Memcpy(EmulationTickThread->PadButtons, HibernatedPadButtons, sizeof(HibernatedPadButtons));
+	HibernatedState.Empty();
+
+	UE_LOG(LogUEnesTiming, Verbose, TEXT("%s resumed in %.2f ms"), *GetName(), (FPlatformTime::Seconds() - StartTime) * 1000.0);
+	return true;
+}
+
+void UNesComponent::UpdateHibernation()
+{
+	AActor* Owner = GetOwner();
+	if (HibernateAfterSecondsUnseen <= 0.f || Owner == nullptr)
+	{
+		return;
+	}
+
+	if (bHibernating)
+	{
+		if (Owner->WasRecentlyRendered(0.2f))
+		{
+			Resume();
+		}
+	}
+	else if (EmulationTickThread != nullptr && EmulationTickThread->IsRunning() && !Owner->WasRecentlyRendered(HibernateAfterSecondsUnseen))
+	{
+		Hibernate();
+	}
 }
 
 void UNesComponent::SetUpdateVideoOnRenderThread(bool bNewValue)
@@ -160,6 +415,21 @@ void UNesComponent::ResetAudioBuffer()
 
 }
 
+FNesFrameStats UNesComponent::GetFrameStats() const
+{
+	FNesFrameStats Stats;
+	Stats.FramesRun = EmulationTickThread ? EmulationTickThread->GetNumFramesRun() : 0;
+	Stats.FramesPresented = NumFramesPresented;
+	Stats.FramesSkipped = NumFramesSkipped;
+
+	if (NesSoundStream)
+	{
+		Stats.AudioQueuedSamples = NesSoundStream->GetAvailableAudioByteCount() / (sizeof(float) * NesSettings.GetNumAudioChannels());
+	}
+
+	return Stats;
+}
+
 void UNesComponent::PullZapperTrigger()
 {
 	if (EmulationTickThread)
@@ -180,6 +450,7 @@ void UNesComponent::ReleaseZapperTrigger(float X, float Y)
 
 void UNesComponent::PostExecuteFrame(int32 AudioByteCount)
 {
+	SCOPE_CYCLE_COUNTER(STAT_NesQueueAudio);
 	
 #if !NES_USE_AUDIO_QUEUE
 	NesSoundStream->QueueAudio(AudioBuffer.GetData(), AudioByteCount);
@@ -200,7 +471,9 @@ void UNesComponent::PostExecuteFrame(int32 AudioByteCount)
 			}
 			else
 			{
-				BytesWritten = i / 2 * 2;
+				// Only hand over whole frames, a partial one would swap the channels of everything after it
+				const int32 FrameByteSize = sizeof(float) * NesSettings.GetNumAudioChannels();
+				BytesWritten = i / FrameByteSize * FrameByteSize;
 				break;
 			}
 		}
@@ -210,21 +483,80 @@ void UNesComponent::PostExecuteFrame(int32 AudioByteCount)
 	
 	
 #endif
+}
 
-	if (bUpdateVideoOnRenderThread)
+void UNesComponent::BeginRamSearch()
+{
+	if (!RamSearch.IsValid())
 	{
-		ENQUEUE_RENDER_COMMAND(NesScreenUpdate)([ScreenTexturePtr = ScreenTexture, ScreenWidth = NesSettings.ScreenWidth, ScreenHeight = NesSettings.ScreenHeight, VideoBufferCopy = VideoBuffer](FRHICommandListImmediate& RHICmdList)
-			{
-				FUpdateTextureRegion2D Region(0, 0, 0, 0, ScreenWidth, ScreenHeight);
-				RHICmdList.UpdateTexture2D(ScreenTexturePtr->GetResource()->GetTexture2DRHI(), 0, Region, ScreenWidth * 4, VideoBufferCopy.GetData());
-			});
+		RamSearch = MakeUnique<FNesRamSearch>();
+	}
+	RamSearch->Reset();
+
+	if (EmulationTickThread != nullptr)
+	{
+		EmulationTickThread->bCaptureRam = true;
+	}
+}
+
+void UNesComponent::EndRamSearch()
+{
+	RamSearch.Reset();
+
+	if (EmulationTickThread != nullptr)
+	{
+		EmulationTickThread->bCaptureRam = false;
+	}
+}
+
+int32 UNesComponent::FilterRamSearch(ENesRamCompare Compare, int32 Value)
+{
+	if (!RamSearch.IsValid() || !RamSearch->HasSnapshot())
+	{
+		UE_LOG(LogUEnesTiming, Warning, TEXT("%s FilterRamSearch called before a frame was captured, call BeginRamSearch first"), *GetName());
+		return 0;
+	}
+
+	return RamSearch->Filter(Compare, (uint8)Value);
+}
+
+TArray<int32> UNesComponent::GetRamSearchResults(int32 MaxResults) const
+{
+	TArray<int32> Addresses;
+	if (RamSearch.IsValid())
+	{
+		RamSearch->GetCandidates(Addresses, MaxResults);
+	}
+	return Addresses;
+}
+
+int32 UNesComponent::GetRamSearchValue(int32 Address) const
+{
+	return RamSearch.IsValid() ? RamSearch->GetValue(Address) : 0;
+}
+
+void UNesComponent::AddCheat(const FCheatCode& Cheat)
+{
+	if (Cheat.Address < 0 || Cheat.Address > 0xFFFF)
+	{
+		UE_LOG(LogUEnesTiming, Warning, TEXT("%s ignoring cheat with invalid address %d"), *GetName(), Cheat.Address);
+		return;
 	}
-	else
+
+	ActiveCheats.Add(Cheat);
+
+	if (EmulationTickThread != nullptr)
+	{
+		EmulationTickThread->AddCheatCode((uint16)Cheat.Address, Cheat.Value);
+	}
+}
+
+void UNesComponent::ClearCheats()
+{
+	ActiveCheats.Empty();
+
+	if (EmulationTickThread != nullptr)
 	{
-		// Draw directly on to the texture. Maniuplating the platfrom data is a bit hacky but should be fine since ScreenTexture is a transient texture and not actually being cooked
-		void* Pixels = ScreenTexture->GetPlatformData()->Mips[0].BulkData.Lock(LOCK_READ_WRITE);
-		FMemory::Memcpy(Pixels, VideoBuffer.GetData(), VideoBuffer.Num());
-		ScreenTexture->GetPlatformData()->Mips[0].BulkData.Unlock();
-		ScreenTexture->UpdateResource();
+		EmulationTickThread->ClearCheatCodes();
 	}
 }
@@ -0,0 +1,90 @@
+#include "NesEmulatorPoolSubsystem.h"
+#include "UEnes.h"
+#include "NesThread.h"
+#include "Async/Async.h"
+
+DECLARE_CYCLE_STAT(TEXT("Emulator Pool Checkout"), STAT_NesEmulatorPoolCheckout, STATGROUP_UEnes);
+
+bool UNesEmulatorPoolSubsystem::DoesSupportWorldType(const EWorldType::Type WorldType) const
+{
+	return WorldType == EWorldType::Game || WorldType == EWorldType::PIE;
+}
+
+void UNesEmulatorPoolSubsystem::OnWorldBeginPlay(UWorld& InWorld)
+{
+	Super::OnWorldBeginPlay(InWorld);
+
+	PrewarmAsync(NumPrewarmedEmulators);
+}
+
+void UNesEmulatorPoolSubsystem::Deinitialize()
+{
+	for (TFuture<void>& PendingPrewarm : PendingPrewarms)
+	{
+		PendingPrewarm.Wait();
+	}
+	PendingPrewarms.Empty();
+
+	for (FEmulatorThreaded* Emulator : IdleEmulators)
+	{
+		delete Emulator;
+	}
+	IdleEmulators.Empty();
+
+	Super::Deinitialize();
+}
+
+FEmulatorThreaded* UNesEmulatorPoolSubsystem::Checkout(UNesComponent* NesComponent, const FNesSettings& Settings)
+{
+	FEmulatorThreaded* Emulator = nullptr;
+	{
+		SCOPE_CYCLE_COUNTER(STAT_NesEmulatorPoolCheckout);
+		const double StartTime = FPlatformTime::Seconds();
+
+		{
+			FScopeLock PoolLock(&PoolCriticalSection);
+
+			const int32 Index = IdleEmulators.IndexOfByPredicate([&Settings](const FEmulatorThreaded* Candidate) { return Candidate->CanAttach(Settings); });
+			if (Index != INDEX_NONE)
+			{
+				Emulator = IdleEmulators[Index];
+				IdleEmulators.RemoveAtSwap(Index);
+			}
+		}
+
+		if (Emulator == nullptr)
+		{
+			return nullptr;
+		}
+
+		Emulator->AttachComponent(NesComponent, Settings);
+		UE_LOG(LogUEnesTiming, Verbose, TEXT("%s checked out a prewarmed emulator in %.1f us"), *NesComponent->GetName(), (FPlatformTime::Seconds() - StartTime) * 1000000.0);
+	}
+
+	PrewarmAsync(1);
+	return Emulator;
+}
+
+void UNesEmulatorPoolSubsystem::PrewarmAsync(int32 Count)
+{
+	PendingPrewarms.RemoveAll([](const TFuture<void>& PendingPrewarm) { return PendingPrewarm.IsReady(); });
+
+	FNesSettings Settings;
+	Settings.InitializeAudioSettings();
+
+	for (int32 i = 0; i < Count; i++)
+	{
+		PendingPrewarms.Add(Async(EAsyncExecution::ThreadPool, [this, Settings]()
+			{
+				const double StartTime = FPlatformTime::Seconds();
+
+				FEmulatorThreaded* Emulator = new FEmulatorThreaded(nullptr, Settings);
+				Emulator->Prewarm();
+
+				UE_LOG(LogUEnesTiming, Verbose, TEXT("Prewarmed emulator in %.2f ms"), (FPlatformTime::Seconds() - StartTime) * 1000.0);
+
+				FScopeLock PoolLock(&PoolCriticalSection);
+				IdleEmulators.Add(Emulator);
+			}));
+	}
+}
@@ -0,0 +1,148 @@
+#include "NesRamSearch.h"
+
+#if PLATFORM_CPU_X86_FAMILY
+#include <emmintrin.h>
+#endif
+
+DECLARE_CYCLE_STAT(TEXT("RAM Search Filter"), STAT_NesRamSearchFilter, STATGROUP_UEnes);
+
+FNesRamSearch::FNesRamSearch()
+{
+	FMemory::Memzero(Current, RamSize);
+	FMemory::Memzero(Previous, RamSize);
+	Reset();
+}
+
+void FNesRamSearch::Reset()
+{
+	FMemory::Memset(Candidates, 0xFF, sizeof(Candidates));
+	FMemory::Memcpy(Previous, Current, RamSize);
+}
+
+void FNesRamSearch::Update(const uint8* Ram)
+{
+	FMemory::Memcpy(Current, Ram, RamSize);
+
+	if (!bHasSnapshot)
+	{
+		FMemory::Memcpy(Previous, Current, RamSize);
+		bHasSnapshot = true;
+	}
+}
+
+#if PLATFORM_CPU_X86_FAMILY
+// One bit per byte of Cur/Prev that passes Compare
+template<ENesRamCompare Compare>
+static FORCEINLINE uint32 MatchMask16(const uint8* Cur, const uint8* Prev, __m128i Value)
+{
+	const __m128i C = _mm_load_si128(reinterpret_cast<const __m128i*>(Cur));
+	const __m128i P = _mm_load_si128(reinterpret_cast<const __m128i*>(Prev));
+	const __m128i Zero = _mm_setzero_si128();
+
+	switch (Compare)
+	{
+	case ENesRamCompare::EqualTo:		return _mm_movemask_epi8(_mm_cmpeq_epi8(C, Value));
+	case ENesRamCompare::Changed:		return ~_mm_movemask_epi8(_mm_cmpeq_epi8(C, P)) & 0xFFFF;
+	case ENesRamCompare::Unchanged:		return _mm_movemask_epi8(_mm_cmpeq_epi8(C, P));
+	// Saturating subtraction is non zero only where the first operand is larger
+	case ENesRamCompare::Increased:		return ~_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_subs_epu8(C, P), Zero)) & 0xFFFF;
+	case ENesRamCompare::Decreased:		return ~_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_subs_epu8(P, C), Zero)) & 0xFFFF;
+	case ENesRamCompare::IncreasedBy:	return _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_sub_epi8(C, P), Value));
+	case ENesRamCompare::DecreasedBy:	return _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_sub_epi8(P, C), Value));
+	}
+	return 0;
+}
+#else
+template<ENesRamCompare Compare>
+static FORCEINLINE bool Matches(uint8 Cur, uint8 Prev, uint8 Value)
+{
+	switch (Compare)
+	{
+	case ENesRamCompare::EqualTo:		return Cur == Value;
+	case ENesRamCompare::Changed:		return Cur != Prev;
+	case ENesRamCompare::Unchanged:		return Cur == Prev;
+	case ENesRamCompare::Increased:		return Cur > Prev;
+	case ENesRamCompare::Decreased:		return Cur < Prev;
+	case ENesRamCompare::IncreasedBy:	return uint8(Cur - Prev) == Value;
+	case ENesRamCompare::DecreasedBy:	return uint8(Prev - Cur) == Value;
+	}
+	return false;
+}
+#endif
+
+template<ENesRamCompare Compare>
+void FNesRamSearch::FilterWords(uint8 Value)
+{
+#if PLATFORM_CPU_X86_FAMILY
+	const __m128i VectorValue = _mm_set1_epi8((char)Value);
+#endif
+
+	for (int32 Word = 0; Word < NumWords; Word++)
+	{
+		// Most of RAM is ruled out after the first couple of filters, skip those words entirely
+		if (Candidates[Word] == 0)
+		{
+			continue;
+		}
+
+		const uint8* Cur = Current + Word * 64;
+		const uint8* Prev = Previous + Word * 64;
+		uint64 Mask = 0;
+
+#if PLATFORM_CPU_X86_FAMILY
+		for (int32 Lane = 0; Lane < 4; Lane++)
+		{
+			Mask |= (uint64)MatchMask16<Compare>(Cur + Lane * 16, Prev + Lane * 16, VectorValue) << (Lane * 16);
+		}
+#else
+		for (int32 i = 0; i < 64; i++)
+		{
+			Mask |= (uint64)Matches<Compare>(Cur[i], Prev[i], Value) << i;
+		}
+#endif
+		Candidates[Word] &= Mask;
+	}
+}
+
+int32 FNesRamSearch::Filter(ENesRamCompare Compare, uint8 Value)
+{
+	SCOPE_CYCLE_COUNTER(STAT_NesRamSearchFilter);
+
+	switch (Compare)
+	{
+	case ENesRamCompare::EqualTo:		FilterWords<ENesRamCompare::EqualTo>(Value); break;
+	case ENesRamCompare::Changed:		FilterWords<ENesRamCompare::Changed>(Value); break;
+	case ENesRamCompare::Unchanged:		FilterWords<ENesRamCompare::Unchanged>(Value); break;
+	case ENesRamCompare::Increased:		FilterWords<ENesRamCompare::Increased>(Value); break;
+	case ENesRamCompare::Decreased:		FilterWords<ENesRamCompare::Decreased>(Value); break;
+	case ENesRamCompare::IncreasedBy:	FilterWords<ENesRamCompare::IncreasedBy>(Value); break;
+	case ENesRamCompare::DecreasedBy:	FilterWords<ENesRamCompare::DecreasedBy>(Value); break;
+	}
+
+	FMemory::Memcpy(Previous, Current, RamSize);
+	return GetNumCandidates();
+}
+
+int32 FNesRamSearch::GetNumCandidates() const
+{
+	int32 NumCandidates = 0;
+	for (int32 Word = 0; Word < NumWords; Word++)
+	{
+		NumCandidates += FMath::CountBits(Candidates[Word]);
+	}
+	return NumCandidates;
+}
+
+void FNesRamSearch::GetCandidates(TArray<int32>& OutAddresses, int32 MaxResults) const
+{
+	for (int32 Word = 0; Word < NumWords && MaxResults > 0; Word++)
+	{
+		uint64 Bits = Candidates[Word];
+		while (Bits != 0 && MaxResults > 0)
+		{
+			OutAddresses.Add(Word * 64 + (int32)FMath::CountTrailingZeros64(Bits));
+			Bits &= Bits - 1;
+			MaxResults--;
+		}
+	}
+}
@@ -0,0 +1,245 @@
+#include "NesScreenSubsystem.h"
+#include "UEnes.h"
+#include "Engine/Texture2D.h"
+#include "Engine/Texture2DArray.h"
+#include "RenderingThread.h"
+#include "RHI.h"
+#include "RHICommandList.h"
+#include "TextureResource.h"
+
+DECLARE_CYCLE_STAT(TEXT("Screen Array Upload"), STAT_NesScreenArrayUpload, STATGROUP_UEnes);
+DECLARE_CYCLE_STAT(TEXT("Screen Array Upload (Render Thread)"), STAT_NesScreenArrayUploadRenderThread, STATGROUP_UEnes);
+// Counters are reset every frame, compare them with Screen Texture Updates and Screen Bytes Uploaded of per component textures
+DECLARE_DWORD_COUNTER_STAT(TEXT("Screen Array Render Commands"), STAT_NesScreenArrayRenderCommands, STATGROUP_UEnes);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Screen Array Updates"), STAT_NesScreenArrayUpdates, STATGROUP_UEnes);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Screen Array Copies"), STAT_NesScreenArrayCopies, STATGROUP_UEnes);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Screen Array Bytes Uploaded"), STAT_NesScreenArrayBytesUploaded, STATGROUP_UEnes);
+
+void UNesScreenSubsystem::Deinitialize()
+{
+	for (FSlice& Slice : Slices)
+	{
+		ReleaseFrame(Slice);
+	}
+
+	Slices.Empty();
+	ScreenArray = nullptr;
+	StagingTexture = nullptr;
+
+	Super::Deinitialize();
+}
+
+TStatId UNesScreenSubsystem::GetStatId() const
+{
+	RETURN_QUICK_DECLARE_CYCLE_STAT(UNesScreenSubsystem, STATGROUP_Tickables);
+}
+
+int32 UNesScreenSubsystem::AcquireSlice(int32 InWidth, int32 InHeight, bool bIndexed)
+{
+	const int32 InBytesPerPixel = bIndexed ? sizeof(uint16) : 4;
+
+	if (ScreenArray == nullptr)
+	{
+		Width = InWidth;
+		Height = InHeight;
+		BytesPerPixel = InBytesPerPixel;
+
+		const int32 NumScreens = FMath::Clamp(MaxScreens, 1, (int32)GetMax2DTextureDimension() / Height);
+		if (NumScreens < MaxScreens)
+		{
+			UE_LOG(LogUEnesVideo, Warning, TEXT("Shared screen array limited to %d screens by the largest 2D texture the RHI supports"), NumScreens);
+		}
+
+		const EPixelFormat PixelFormat = bIndexed ? EPixelFormat::PF_R16_UINT : EPixelFormat::PF_R8G8B8A8;
+		ScreenArray = UTexture2DArray::CreateTransient(Width, Height, NumScreens, PixelFormat, FName(TEXT("ScreenArray") + FGuid::NewGuid().ToString()));
+		ScreenArray->Filter = TextureFilter::TF_Nearest;
+		ScreenArray->SRGB = !bIndexed;
+		ScreenArray->LODGroup = TextureGroup::TEXTUREGROUP_UI;
+		ScreenArray->UpdateResource();
+
+		StagingTexture = UTexture2D::CreateTransient(Width, Height * NumScreens, PixelFormat, FName(TEXT("ScreenArrayStaging") + FGuid::NewGuid().ToString()));
+		StagingTexture->SRGB = !bIndexed;
+		StagingTexture->UpdateResource();
+
+		Slices.SetNum(NumScreens);
+	}
+	else if (Width != InWidth || Height != InHeight || BytesPerPixel != InBytesPerPixel)
+	{
+		UE_LOG(LogUEnesVideo, Warning, TEXT("Screen format does not match the shared screen array"));
+		return INDEX_NONE;
+	}
+
+	for (int32 i = 0; i < Slices.Num(); i++)
+	{
+		if (!Slices[i].bInUse)
+		{
+			// Whatever the previous owner left behind is overwritten by the first frame submitted
+			Slices[i].bInUse = true;
+			Slices[i].PendingRows.Init(true, Height);
+			return i;
+		}
+	}
+
+	UE_LOG(LogUEnesVideo, Warning, TEXT("Shared screen array is full (%d screens)"), Slices.Num());
+	return INDEX_NONE;
+}
+
+void UNesScreenSubsystem::ReleaseSlice(int32 Slice)
+{
+	if (Slices.IsValidIndex(Slice))
+	{
+		ReleaseFrame(Slices[Slice]);
+		Slices[Slice].bInUse = false;
+		Slices[Slice].PendingRows.Empty();
+	}
+}
+
+void UNesScreenSubsystem::ReleaseFrame(FSlice& Slice)
+{
+	if (Slice.BufferIndex != INDEX_NONE)
+	{
+		Slice.Pool->Release(Slice.BufferIndex);
+	}
+
+	Slice.Pool.Reset();
+	Slice.BufferIndex = INDEX_NONE;
+}
+
+void UNesScreenSubsystem::SubmitFrame(int32 Slice, const FNesStagingPoolPtr& Pool, int32 BufferIndex, const FNesDirtyRows& DirtyRows)
+{
+	if (!Slices.IsValidIndex(Slice) || !Slices[Slice].bInUse)
+	{
+		Pool->Release(BufferIndex);
+		return;
+	}
+
+	// Buffers always hold a whole frame, so rows still pending from a frame that never got uploaded are taken from this one
+	FSlice& SliceData = Slices[Slice];
+	ReleaseFrame(SliceData);
+	SliceData.Pool = Pool;
+	SliceData.BufferIndex = BufferIndex;
+	SliceData.PendingRows.CombineWithBitwiseOR(DirtyRows, EBitwiseOperatorFlags::MaintainSize);
+}
+
+void UNesScreenSubsystem::Tick(float DeltaTime)
+{
+	SCOPE_CYCLE_COUNTER(STAT_NesScreenArrayUpload);
+
+	FTextureResource* Resource = ScreenArray ? ScreenArray->GetResource() : nullptr;
+	FTextureResource* StagingResource = StagingTexture ? StagingTexture->GetResource() : nullptr;
+	if (Resource == nullptr || StagingResource == nullptr)
+	{
+		return;
+	}
+
+	// The changed rows of one slice's latest frame. Each range is written to the staging texture, then the span
+	// covering all of them is copied into the array at once
+	struct FSliceUpload
+	{
+		int32 Slice;
+		FNesStagingPoolPtr Pool;
+		int32 BufferIndex;
+		int32 FirstRow;
+		int32 EndRow;
+		TArray<FIntPoint, TInlineAllocator<8>> RowRanges;
+	};
+
+	const int32 Pitch = Width * BytesPerPixel;
+	TArray<FSliceUpload> Uploads;
+	int32 NumUpdates = 0;
+	int32 NumBytes = 0;
+
+	for (int32 i = 0; i < Slices.Num(); i++)
+	{
+		FSlice& Slice = Slices[i];
+		if (!Slice.bInUse || Slice.BufferIndex == INDEX_NONE)
+		{
+			continue;
+		}
+
+		int32 Row = Slice.PendingRows.Find(true);
+		if (Row == INDEX_NONE || Row >= Height)
+		{
+			ReleaseFrame(Slice);
+			continue;
+		}
+
+		FSliceUpload& Upload = Uploads.AddDefaulted_GetRef();
+		Upload.Slice = i;
+		Upload.Pool = MoveTemp(Slice.Pool);
+		Upload.BufferIndex = Slice.BufferIndex;
+		Upload.FirstRow = Row;
+		Slice.BufferIndex = INDEX_NONE;
+
+		while (Row != INDEX_NONE && Row < Height)
+		{
+			int32 EndRow = Row + 1;
+			while (EndRow < Height && Slice.PendingRows[EndRow])
+			{
+				EndRow++;
+			}
+
+			Upload.RowRanges.Emplace(Row, EndRow - Row);
+			Upload.EndRow = EndRow;
+			NumBytes += (EndRow - Row) * Pitch;
+
+			Row = Slice.PendingRows.FindFrom(true, EndRow);
+		}
+
+		NumUpdates += Upload.RowRanges.Num();
+		Slice.PendingRows.Init(false, Height);
+	}
+
+	if (Uploads.Num() == 0)
+	{
+		return;
+	}
+
+	// One render command holding an update per row range, a copy per slice and two batched transitions
+	INC_DWORD_STAT(STAT_NesScreenArrayRenderCommands);
+	INC_DWORD_STAT_BY(STAT_NesScreenArrayUpdates, NumUpdates);
+	INC_DWORD_STAT_BY(STAT_NesScreenArrayCopies, Uploads.Num());
+	INC_DWORD_STAT_BY(STAT_NesScreenArrayBytesUploaded, NumBytes);
+	UE_LOG(LogUEnesVideo, VeryVerbose, TEXT("Screen array: %d updates and %d copies, %d bytes"), NumUpdates, Uploads.Num(), NumBytes);
+
+	ENQUEUE_RENDER_COMMAND(NesScreenArrayUpdate)([Resource, StagingResource, Uploads = MoveTemp(Uploads), Width = Width, Height = Height, Pitch](FRHICommandListImmediate& RHICmdList)
+		{
+			SCOPE_CYCLE_COUNTER(STAT_NesScreenArrayUploadRenderThread);
+
+			FRHITexture* ArrayRHI = Resource->GetTextureRHI();
+			FRHITexture* StagingRHI = StagingResource->GetTextureRHI();
+
+			// Every slice has its own region of the staging texture, so all of them are written before anything is copied
+			for (const FSliceUpload& Upload : Uploads)
+			{
+				const uint8* BufferData = Upload.Pool->GetBuffer(Upload.BufferIndex);
+				for (const FIntPoint& Range : Upload.RowRanges)
+				{
+					const FUpdateTextureRegion2D Region(0, Upload.Slice * Height + Range.X, 0, 0, Width, Range.Y);
+					RHICmdList.UpdateTexture2D(StagingRHI, 0, Region, Pitch, BufferData + Range.X * Pitch);
+				}
+
+				// The command list has consumed the source data, the buffer can be reused
+				Upload.Pool->Release(Upload.BufferIndex);
+			}
+
+			RHICmdList.Transition({
+				FRHITransitionInfo(StagingRHI, ERHIAccess::SRVMask, ERHIAccess::CopySrc),
+				FRHITransitionInfo(ArrayRHI, ERHIAccess::SRVMask, ERHIAccess::CopyDest) });
+
+			for (const FSliceUpload& Upload : Uploads)
+			{
+				FRHICopyTextureInfo CopyInfo;
+				CopyInfo.Size = FIntVector(Width, Upload.EndRow - Upload.FirstRow, 1);
+				CopyInfo.SourcePosition = FIntVector(0, Upload.Slice * Height + Upload.FirstRow, 0);
+				CopyInfo.DestPosition = FIntVector(0, Upload.FirstRow, 0);
+				CopyInfo.DestSliceIndex = Upload.Slice;
+				CopyInfo.NumSlices = 1;
+				RHICmdList.CopyTexture(StagingRHI, ArrayRHI, CopyInfo);
+			}
+
+			RHICmdList.Transition({
+				FRHITransitionInfo(StagingRHI, ERHIAccess::CopySrc, ERHIAccess::SRVMask),
+				FRHITransitionInfo(ArrayRHI, ERHIAccess::CopyDest, ERHIAccess::SRVMask) });
+		});
+}
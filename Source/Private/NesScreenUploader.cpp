@@ -0,0 +1,114 @@
+#include "NesScreenUploader.h"
+#include "UEnes.h"
+#include "Engine/Texture2D.h"
+#include "RenderingThread.h"
+#include "TextureResource.h"
+
+DECLARE_CYCLE_STAT(TEXT("Screen Upload"), STAT_NesScreenUpload, STATGROUP_UEnes);
+DECLARE_CYCLE_STAT(TEXT("Screen Upload (Render Thread)"), STAT_NesScreenUploadRenderThread, STATGROUP_UEnes);
+// Counters are reset every frame, so this shows the bytes uploaded in the last frame
+DECLARE_DWORD_COUNTER_STAT(TEXT("Screen Bytes Uploaded"), STAT_NesScreenBytesUploaded, STATGROUP_UEnes);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Screen Texture Render Commands"), STAT_NesScreenRenderCommands, STATGROUP_UEnes);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Screen Texture Updates"), STAT_NesScreenTextureUpdates, STATGROUP_UEnes);
+
+FNesStagingPool::FNesStagingPool(int32 InFrameSize) :
+	FrameSize(InFrameSize)
+{
+	for (int32 i = 0; i < NumBuffers; i++)
+	{
+		Buffers[i].SetNumUninitialized(FrameSize);
+		FreeBuffers.Enqueue(i);
+	}
+}
+
+int32 FNesStagingPool::Acquire()
+{
+	int32 BufferIndex;
+	return FreeBuffers.Dequeue(BufferIndex) ? BufferIndex : INDEX_NONE;
+}
+
+void FNesStagingPool::Release(int32 BufferIndex)
+{
+	FreeBuffers.Enqueue(BufferIndex);
+}
+
+FNesScreenUploader::FNesScreenUploader(int32 InWidth, int32 InHeight, int32 InBytesPerPixel) :
+	Pool(MakeShared<FNesStagingPool, ESPMode::ThreadSafe>(InWidth * InHeight * InBytesPerPixel)),
+	Width(InWidth),
+	Height(InHeight),
+	BytesPerPixel(InBytesPerPixel),
+	PendingRows(true, InHeight)
+{
+}
+
+bool FNesScreenUploader::UploadFrame(UTexture2D* Texture, int32 BufferIndex, const FNesDirtyRows& DirtyRows)
+{
+	SCOPE_CYCLE_COUNTER(STAT_NesScreenUpload);
+
+	PendingRows.CombineWithBitwiseOR(DirtyRows, EBitwiseOperatorFlags::MaintainSize);
+
+	if (PendingRows.Find(true) == INDEX_NONE)
+	{
+		Pool->Release(BufferIndex);
+		return true;
+	}
+
+	FTextureResource* Resource = Texture ? Texture->GetResource() : nullptr;
+	if (Resource == nullptr)
+	{
+		Pool->Release(BufferIndex);
+		NumDroppedFrames++;
+		UE_LOG(LogUEnesVideo, VeryVerbose, TEXT("Dropped screen upload, %d total"), NumDroppedFrames);
+		return false;
+	}
+
+	// Staging buffers always hold a whole frame, so rows left pending by earlier frames can be taken from this one
+	const int32 Pitch = Width * BytesPerPixel;
+	TArray<FUpdateTextureRegion2D, TInlineAllocator<16>> Regions;
+
+	for (int32 Row = PendingRows.Find(true); Row != INDEX_NONE && Row < Height; )
+	{
+		int32 EndRow = Row + 1;
+		while (EndRow < Height && PendingRows[EndRow])
+		{
+			EndRow++;
+		}
+
+		Regions.Emplace(0, Row, 0, Row, Width, EndRow - Row);
+		NumUploadedBytes += (EndRow - Row) * Pitch;
+		INC_DWORD_STAT_BY(STAT_NesScreenBytesUploaded, (EndRow - Row) * Pitch);
+
+		Row = PendingRows.FindFrom(true, EndRow);
+	}
+
+	PendingRows.Init(false, Height);
+
+	INC_DWORD_STAT(STAT_NesScreenRenderCommands);
+	INC_DWORD_STAT_BY(STAT_NesScreenTextureUpdates, Regions.Num());
+
+	ENQUEUE_RENDER_COMMAND(NesScreenUpdate)([Resource, BufferIndex, PoolRef = Pool, Regions = MoveTemp(Regions), Pitch](FRHICommandListImmediate& RHICmdList)
+		{
+			SCOPE_CYCLE_COUNTER(STAT_NesScreenUploadRenderThread);
+
+			const uint8* BufferData = PoolRef->GetBuffer(BufferIndex);
+			for (const FUpdateTextureRegion2D& Region : Regions)
+			{
+				RHICmdList.UpdateTexture2D(Resource->GetTexture2DRHI(), 0, Region, Pitch, BufferData + Region.SrcY * Pitch);
+			}
+
+			// The command list has consumed the source data, the buffer can be reused
+			PoolRef->Release(BufferIndex);
+		});
+
+#if !UE_BUILD_SHIPPING
+	const double Now = FPlatformTime::Seconds();
+	if (Now - LastReportTime >= 1.0)
+	{
+		UE_LOG(LogUEnesVideo, VeryVerbose, TEXT("Screen upload: %.1f KB/s"), (NumUploadedBytes - NumUploadedBytesAtLastReport) / 1024.0 / (Now - LastReportTime));
+		NumUploadedBytesAtLastReport = NumUploadedBytes;
+		LastReportTime = Now;
+	}
+#endif
+
+	return true;
+}
@@ -11,7 +11,7 @@ UNesSoundStream::UNesSoundStream(const FObjectInitializer& ObjectInitializer)
 	VirtualizationMode = EVirtualizationMode::PlayWhenSilent;
 	NumChannels = 1;
 	SampleRate = 44100;
-	SampleByteSize = 2;
+	SampleByteSize = sizeof(float);
 	bGenerateWhiteNoise = true;
 	NoiseVolume = 0.15;
 }
@@ -20,14 +20,14 @@ int32 UNesSoundStream::OnGeneratePCMAudio(TArray<uint8>& OutAudio, int32 NumSamp
 {
 	if (bGenerateWhiteNoise)
 	{
+		// NumSamples counts every channel, so the noise fits whatever channel count the stream was created with
 		for (int i = 0; i < NumSamples; i++)
 		{
 			float Output = WhiteNoise.Generate(NoiseVolume, 0);
 			
 			uint8* ByteArray = reinterpret_cast<uint8*>(&Output);
 
-			OutAudio.Append(ByteArray, 4);
-			OutAudio.Append(ByteArray, 4);
+			OutAudio.Append(ByteArray, sizeof(float));
 		}
 				
 	}
@@ -40,9 +40,16 @@ void UNesSoundStream::StreamWhiteNoise()
 	bGenerateWhiteNoise = true;
 }
 
-void UNesSoundStream::StreamGameAudio(float SamplesPerFrame)
+void UNesSoundStream::SetNumChannels(int32 InNumChannels)
+{
+	NumChannels = InNumChannels;
+}
+
+void UNesSoundStream::StreamGameAudio(float SamplesPerFrame, int32 InNumChannels)
 {
 	ResetAudio();
+	// A playing mixer source keeps the channel count it started with
+	ensureMsgf(InNumChannels == NumChannels, TEXT("Sound stream was created with %d channels, game audio has %d"), NumChannels, InNumChannels);
 	//NumSamplesToGeneratePerCallback = 48000;
 	NumSamplesToGeneratePerCallback = SamplesPerFrame;
 	bGenerateWhiteNoise = false;
@@ -0,0 +1,186 @@
+#include "NesStateSearch.h"
+#include "NesThread.h"
+#include "EmuCore/api/NstApiCheats.hpp"
+#include "Async/ParallelFor.h"
+#include "Hash/CityHash.h"
+#include "Misc/FileHelper.h"
+
+#include <sstream>
+
+FNesStateSearch::FNesStateSearch(const FNesStateSearchSettings& InSettings) :
+	Settings(InSettings)
+{
+	Settings.FramesPerAction = FMath::Max(Settings.FramesPerAction, 1);
+	const int32 NumWorkers = Settings.NumWorkers > 0 ? Settings.NumWorkers : FMath::Max(FTaskGraphInterface::Get().GetNumWorkerThreads(), 1);
+
+	TArray<uint8> RomData;
+	if (!FFileHelper::LoadFileToArray(RomData, *Settings.RomPath))
+	{
+		UE_LOG(LogUEnesTiming, Error, TEXT("State search could not read %s"), *Settings.RomPath);
+		return;
+	}
+
+	const string Rom(reinterpret_cast<const char*>(RomData.GetData()), RomData.Num());
+
+	for (int32 i = 0; i < NumWorkers; i++)
+	{
+		TUniquePtr<FWorker> Worker = MakeUnique<FWorker>();
+		istringstream RomStream(Rom, ios::binary);
+
+		if (NES_FAILED(FEmulatorThreaded::LoadHeadless(Worker->Emulator, RomStream)))
+		{
+			UE_LOG(LogUEnesTiming, Error, TEXT("State search could not load %s"), *Settings.RomPath);
+			UnloadAll();
+			return;
+		}
+
+		Workers.Add(MoveTemp(Worker));
+	}
+
+	if (Settings.RootState.Num() == 0)
+	{
+		FEmulatorThreaded::SaveStateToArray(Workers[0]->Emulator, Settings.RootState, Nes::Machine::NO_COMPRESSION);
+	}
+}
+
+FNesStateSearch::~FNesStateSearch()
+{
+	UnloadAll();
+}
+
+void FNesStateSearch::UnloadAll()
+{
+	// Unloading fires the static callbacks, so it can't be left to the emulators' destructors
+	for (TUniquePtr<FWorker>& Worker : Workers)
+	{
+		FEmulatorThreaded::UnloadHeadless(Worker->Emulator);
+	}
+
+	Workers.Empty();
+}
+
+bool FNesStateSearch::Expand(FWorker& Worker, const FNode& Parent, uint8 ActionIndex, FNode& OutChild, uint64& OutRamHash, bool& bOutGoal) const
+{
+	// Restoring resets the machine if the state is rejected halfway, so it takes the core lock like the batch environment's restores
+	if (NES_FAILED(FEmulatorThreaded::LoadStateHeadless(Worker.Emulator, Parent.State)))
+	{
+		return false;
+	}
+
+	Worker.Input.pad[0].buttons = Settings.Actions[ActionIndex];
+	for (int32 Frame = 0; Frame < Settings.FramesPerAction; Frame++)
+	{
+		Worker.Emulator.Execute(NULL, NULL, &Worker.Input);
+	}
+
+	const uint8* Ram = Nes::Cheats(Worker.Emulator).GetRam();
+	if (Settings.Prune && Settings.Prune(Ram))
+	{
+		return false;
+	}
+
+	OutRamHash = CityHash64(reinterpret_cast<const char*>(Ram), Nes::Cheats::RAM_SIZE);
+	bOutGoal = Settings.Goal && Settings.Goal(Ram);
+	OutChild.Score = Settings.Score ? Settings.Score(Ram) : 0.f;
+	OutChild.Path = Parent.Path;
+	OutChild.Path.Add(ActionIndex);
+
+	FEmulatorThreaded::SaveStateToArray(Worker.Emulator, OutChild.State, Nes::Machine::NO_COMPRESSION);
+	return true;
+}
+
+FNesStateSearchResult FNesStateSearch::Run()
+{
+	FNesStateSearchResult Result;
+	if (Workers.Num() == 0 || Settings.Actions.Num() == 0)
+	{
+		return Result;
+	}
+
+	const double StartTime = FPlatformTime::Seconds();
+
+	TArray<FNode> Frontier;
+	Frontier.AddDefaulted_GetRef().State = Settings.RootState;
+
+	// The root counts as visited, otherwise an action that changes nothing would put it back in the frontier
+	TSet<uint64> Visited;
+	{
+		if (NES_FAILED(FEmulatorThreaded::LoadStateHeadless(Workers[0]->Emulator, Settings.RootState)))
+		{
+			UE_LOG(LogUEnesTiming, Error, TEXT("State search could not restore its root state"));
+			return Result;
+		}
+
+		Visited.Add(CityHash64(reinterpret_cast<const char*>(Nes::Cheats(Workers[0]->Emulator).GetRam()), Nes::Cheats::RAM_SIZE));
+	}
+
+	for (int32 Depth = 0; Depth < Settings.MaxDepth && Frontier.Num() > 0 && !Result.bFound; Depth++)
+	{
+		const int32 NumActions = Settings.Actions.Num();
+		const int32 NumExpansions = Frontier.Num() * NumActions;
+
+		// Written from the workers, so one element per expansion rather than packed bits
+		TArray<FNode> Children;
+		TArray<uint64> Hashes;
+		TArray<bool> Valid;
+		TArray<bool> Goals;
+		Children.SetNum(NumExpansions);
+		Hashes.SetNumZeroed(NumExpansions);
+		Valid.SetNumZeroed(NumExpansions);
+		Goals.SetNumZeroed(NumExpansions);
+
+		// Each worker owns an emulator, so the expansions are split into one contiguous chunk per worker
+		const int32 ChunkSize = FMath::DivideAndRoundUp(NumExpansions, Workers.Num());
+		ParallelFor(Workers.Num(), [&](int32 WorkerIndex)
+			{
+				const int32 First = WorkerIndex * ChunkSize;
+				const int32 Last = FMath::Min(First + ChunkSize, NumExpansions);
+
+				for (int32 i = First; i < Last; i++)
+				{
+					Valid[i] = Expand(*Workers[WorkerIndex], Frontier[i / NumActions], i % NumActions, Children[i], Hashes[i], Goals[i]);
+				}
+			});
+
+		Result.StatesExplored += NumExpansions;
+
+		TArray<FNode> NextFrontier;
+		for (int32 i = 0; i < NumExpansions; i++)
+		{
+			if (!Valid[i])
+			{
+				continue;
+			}
+
+			if (Goals[i])
+			{
+				Result.bFound = true;
+				Result.Path = MoveTemp(Children[i].Path);
+				Result.State = MoveTemp(Children[i].State);
+				break;
+			}
+
+			bool bAlreadyVisited = false;
+			Visited.Add(Hashes[i], &bAlreadyVisited);
+			if (!bAlreadyVisited)
+			{
+				NextFrontier.Add(MoveTemp(Children[i]));
+			}
+		}
+
+		if (Settings.BeamWidth > 0 && NextFrontier.Num() > Settings.BeamWidth)
+		{
+			NextFrontier.Sort([](const FNode& A, const FNode& B) { return A.Score > B.Score; });
+			NextFrontier.SetNum(Settings.BeamWidth);
+		}
+
+		Frontier = MoveTemp(NextFrontier);
+	}
+
+	Result.Seconds = FPlatformTime::Seconds() - StartTime;
+
+	UE_LOG(LogUEnesTiming, Log, TEXT("State search explored %lld states in %.2f s, %.0f states/sec per worker (%d workers)"),
+		Result.StatesExplored, Result.Seconds, Result.Seconds > 0 ? Result.StatesExplored / Result.Seconds / Workers.Num() : 0.0, Workers.Num());
+
+	return Result;
+}
@@ -5,6 +5,7 @@
 #include "GenericPlatform/GenericPlatformProperties.h"
 #include "EmuCore/NstBase.hpp"
 #include "Async/TaskGraphInterfaces.h"
+#include "ProfilingDebugging/CpuProfilerTrace.h"
 
 #include <fstream>
 
@@ -12,6 +13,13 @@
 FCriticalSection FEmulatorThreaded::CoreCriticalSection;
 #endif
 
+// The core runs the CPU, PPU, APU and video filter for a whole frame inside Emulator::Execute, so they can only be timed together.
+// Cycle counters add up every instance, per instance timings are in the trace scopes named after the component
+DECLARE_CYCLE_STAT(TEXT("Execute Frame (CPU, PPU, APU, Filter)"), STAT_NesExecuteFrame, STATGROUP_UEnes);
+DECLARE_CYCLE_STAT(TEXT("Convert Audio"), STAT_NesConvertAudio, STATGROUP_UEnes);
+DECLARE_CYCLE_STAT(TEXT("Find Dirty Rows"), STAT_NesFindDirtyRows, STATGROUP_UEnes);
+DECLARE_CYCLE_STAT(TEXT("Frame Handoff"), STAT_NesFrameHandoff, STATGROUP_UEnes);
+
 class FNesGraphTask
 	: public FAsyncGraphTaskBase
 {
@@ -48,19 +56,27 @@ FEmulatorThreaded::FEmulatorThreaded(UNesComponent* InNesComponent, const FNesSe
 	NesSettings(InSettings),
 	NesComponent(InNesComponent)
 {
-	Thread = FRunnableThread::Create(this, *(FString(TEXT("EmulatorThreaded")) + InNesComponent->GetName()));
-
 	VideoBuffer.SetNum(NesSettings.ScreenWidth * NesSettings.ScreenHeight * 4);
+	PreviousVideoBuffer.SetNum(VideoBuffer.Num());
+	DirtyRows.Init(false, NesSettings.ScreenHeight);
 
 	// TODO Allocate slack for variable sized sample requests per frame
-	AudioBuffer.SetNum(NesSettings.SamplesPerFrame * 2);
-	
-	// Set the emulator callbacks
-	SetCallbacks();
+	const int32 NumChannels = NesSettings.GetNumAudioChannels();
+	SampleBuffer.SetNum(NesSettings.SamplesPerFrame * NumChannels);
+	AudioBuffer.SetNum(NesSettings.SamplesPerFrame * NumChannels * sizeof(float));
+
+	// Nestopia's callbacks are static, they are only set under CoreCriticalSection right before the core can fire them.
+	// Pooled instances start their thread too, it idles until PlayFromFile so checking one out doesn't create a thread
+	SetTraceNames();
+
+	static FThreadSafeCounter NumPooledThreads;
+	const FString ThreadName = NesComponent != nullptr ? FString(TEXT("EmulatorThreaded")) + NesComponent->GetName() : FString::Printf(TEXT("EmulatorThreadedPooled%d"), NumPooledThreads.Increment());
+	Thread = FRunnableThread::Create(this, *ThreadName);
 }
 
 FEmulatorThreaded::~FEmulatorThreaded()
 {
+	*AliveFlag = false;
 	bShutdown = true;
 	bIsRunning = false;
 	if (Thread)
@@ -68,6 +84,18 @@ FEmulatorThreaded::~FEmulatorThreaded()
 		Thread->WaitForCompletion();
 		delete Thread;
 	}
+
+	// Powering off writes the battery save through Nestopia's static file callback, so it has to happen here with the
+	// callbacks pointing at this instance rather than in Nes::Emulator's destructor with whatever instance set them last
+#if NES_SUPPORT_MULTIPLE_INSTANCES
+	FScopeLock EmulationLock(&CoreCriticalSection);
+#endif
+	SetCallbacks();
+	Nes::Machine(*this).Power(false);
+	Nes::Machine(*this).Unload();
+
+	// Don't leave the callbacks pointing at a deleted instance
+	UnsetCallbacks();
 }
 
 bool FEmulatorThreaded::Init() 
@@ -77,12 +105,6 @@ bool FEmulatorThreaded::Init()
 
 void FEmulatorThreaded::SetCallbacks()
 {
-	Nes::Video::Output::lockCallback.Set(&ScreenLock, this);
-	Nes::Video::Output::unlockCallback.Set(&ScreenUnlock, this);
-
-	Nes::Sound::Output::lockCallback.Set(&AudioLock, this);
-	Nes::Sound::Output::unlockCallback.Set(&AudioUnlock, this);
-
 	Nes::Machine::eventCallback.Set(&OnMachine, this);
 
 	Nes::User::fileIoCallback.Set(&DoFileIO, this);
@@ -107,11 +129,31 @@ uint32 FEmulatorThreaded::Run()
 
 			if (DeltaTime >= FrameExecuteRate)
 			{
+				// Write the frame straight into a free staging buffer of the component's uploader. If there is none the frame's
+				// video is dropped and its rows are carried over to the next one
+				FNesStagingPoolPtr Pool = GetStagingPool();
+				int32 BufferIndex = Pool.IsValid() ? Pool->Acquire() : INDEX_NONE;
+				if (BufferIndex != INDEX_NONE && Pool->GetFrameSize() != GetFrameSize())
+				{
+					// The screen format is changing, the component will hand over a matching pool
+					Pool->Release(BufferIndex);
+					BufferIndex = INDEX_NONE;
+				}
+
+				// The core renders RGBA or palette indices straight into the staging buffer
+				uint8* FrameData = BufferIndex != INDEX_NONE ? Pool->GetBuffer(BufferIndex) : VideoBuffer.GetData();
+				VideoTarget = FrameData;
+
+				{
 #if NES_SUPPORT_MULTIPLE_INSTANCES
-				FScopeLock EmulationLock(&CoreCriticalSection);
+					FScopeLock EmulationLock(&CoreCriticalSection);
 #endif
-				// Run the NES core for one frame
-				ExecuteFrame(true);
+					// Run the NES core for one frame
+					ExecuteFrame(true);
+				}
+
+				// Post-processing only touches this instance's buffers, so other emulators can run their frames meanwhile
+				UpdateDirtyRows(FrameData);
 			
 #if NES_SYNC_THREADS
 				// Let the game thread know that there is a frame ready
@@ -120,37 +162,75 @@ uint32 FEmulatorThreaded::Run()
 					bDataPending = true;
 				}
 #endif
-				FrameNumber++;
 				UE_LOG(LogUEnesTiming, VeryVerbose, TEXT("Delta: %0.4f"), DeltaTime);
 
 				if (bIsRunning && !bShutdown && NesComponent != nullptr)
 				{
-					auto Function = [this, NumSamplesRequestedCopy = NumSamplesRequested, VideoCopy = VideoBuffer, AudioCopy = AudioBuffer]()
+					SCOPE_CYCLE_COUNTER(STAT_NesFrameHandoff);
+					TRACE_CPUPROFILER_EVENT_SCOPE_TEXT(*HandoffTraceName);
+
+					auto Function = [this, Alive = AliveFlag, NumSamplesRequestedCopy = NumSamplesRequested, Pool, BufferIndex, DirtyRowsCopy = DirtyRows, AudioCopy = AudioBuffer, RamCopy = bCaptureRam ? RamBuffer : TArray<uint8>()]()
 						{
-							if (bIsRunning && NesComponent && !bShutdown)
+							if (!*Alive)
+							{
+								// The emulator was deleted while the frame was queued, by Hibernate or EndPlay
+								if (BufferIndex != INDEX_NONE)
+								{
+									Pool->Release(BufferIndex);
+								}
+							}
+							else if (bIsRunning && NesComponent && !bShutdown)
+							{
+								NesComponent->FrameReadyCallback(Pool, BufferIndex, DirtyRowsCopy, AudioCopy, RamCopy, NumSamplesRequestedCopy * NesSettings.GetNumAudioChannels() * sizeof(float));
+							}
+							else if (BufferIndex != INDEX_NONE)
 							{
-								NesComponent->FrameReadyCallback(VideoCopy, AudioCopy, NumSamplesRequestedCopy * 2);
+								// The frame never reached the screen, so its rows can't be considered uploaded
+								Pool->Release(BufferIndex);
+								MarkAllRowsDirty();
 							}
 						};
 
-					LastFrameCallbackTask = TGraphTask<FNesGraphTask>::CreateTask().ConstructAndDispatchWhenReady(ENamedThreads::GameThread, MoveTemp(Function));
+					TGraphTask<FNesGraphTask>::CreateTask().ConstructAndDispatchWhenReady(ENamedThreads::GameThread, MoveTemp(Function));
+
+					if (BufferIndex != INDEX_NONE)
+					{
+						// The rows are the component's to upload now
+						DirtyRows.Init(false, NesSettings.ScreenHeight);
+					}
+				}
+				else if (BufferIndex != INDEX_NONE)
+				{
+					Pool->Release(BufferIndex);
 				}
 
 				StartTime = FDateTime::Now().ToUnixTimestampDecimal();
 
 			}
 		}
+		else if (Nes::Machine(*this).Is(Nes::Machine::ON))
+		{
+			// Powering off saves the battery through the static file callback
+#if NES_SUPPORT_MULTIPLE_INSTANCES
+			FScopeLock EmulationLock(&CoreCriticalSection);
+#endif
+			// PlayFromFile may have loaded and powered on the next game while this thread waited for the lock
+			if (!bIsRunning && Nes::Machine(*this).Is(Nes::Machine::ON))
+			{
+				SetCallbacks();
+				Nes::Machine(*this).Power(false);
+			}
+		}
 		else
 		{
-			Nes::Machine(*this).Power(false);
+			// Nothing to emulate, pooled or powered off. Don't keep a core busy polling for PlayFromFile
+			FPlatformProcess::Sleep(0.001f);
 		}
 		FPlatformProcess::Sleep(0.f);
 	}
-	
-	if (LastFrameCallbackTask.IsValid())
-	{
-		LastFrameCallbackTask->Wait(ENamedThreads::GameThread);
-	}
+
+	// Frame tasks still queued on the game thread are left to run. Stops come from the game thread, which is blocked
+	// waiting for this thread, so waiting on them here would deadlock or run them on this thread
 	UE_LOG(LogUEnesTiming, Verbose, TEXT("Thread loop exiting"));
 	return 0;
 }
@@ -172,8 +252,87 @@ void FEmulatorThreaded::PowerOff()
 	bIsRunning = false;
 }
 
-Nes::Result FEmulatorThreaded::PlayFromFile(FString FileName)
+void FEmulatorThreaded::StopThread()
+{
+	// Leave bIsRunning alone, the thread loop powers the machine off when it sees it cleared
+	bShutdown = true;
+	if (Thread)
+	{
+		Thread->WaitForCompletion();
+		delete Thread;
+		Thread = nullptr;
+	}
+}
+
+bool FEmulatorThreaded::SaveMachineState(TArray<uint8>& OutState)
+{
+	const Nes::Result Result = SaveStateToArray(*this, OutState, Nes::Machine::USE_COMPRESSION);
+	if (NES_FAILED(Result))
+	{
+		UE_LOG(LogUEnesTiming, Warning, TEXT("Failed to save machine state: %d"), Result);
+		return false;
+	}
+
+	return true;
+}
+
+void FEmulatorThreaded::ApplySoundSettings()
 {
+	Nes::Sound NesSound(*this);
+
+	NesSound.SetSampleRate(NesSettings.SampleRate);
+	NesSound.SetSpeaker(NesSettings.bStereo ? Nes::Api::Sound::Speaker::SPEAKER_STEREO : Nes::Api::Sound::Speaker::SPEAKER_MONO);
+	NesSound.SetVolume(1, 100);
+}
+
+void FEmulatorThreaded::Prewarm()
+{
+#if NES_SUPPORT_MULTIPLE_INSTANCES
+	FScopeLock EmulationLock(&CoreCriticalSection);
+#endif
+	// The render state and sample rate persist across loads. Setting the render state creates the filter, but the palette
+	// is only generated once its colors are asked for, so ask now. The filter's lookup table is built from the palette on
+	// the first frame, which is a 512 entry loop. Games that need another palette type regenerate it on load
+	ApplyRenderState(*this, NesSettings);
+	Nes::Video(*this).GetPalette().GetColors();
+	ApplySoundSettings();
+}
+
+bool FEmulatorThreaded::CanAttach(const FNesSettings& InSettings) const
+{
+	// These decide the size of the buffers allocated at construction
+	return NesComponent == nullptr &&
+		InSettings.ScreenWidth == NesSettings.ScreenWidth &&
+		InSettings.ScreenHeight == NesSettings.ScreenHeight &&
+		InSettings.SamplesPerFrame == NesSettings.SamplesPerFrame &&
+		InSettings.bStereo == NesSettings.bStereo &&
+		InSettings.bIndexedVideo == NesSettings.bIndexedVideo;
+}
+
+void FEmulatorThreaded::AttachComponent(UNesComponent* InNesComponent, const FNesSettings& InSettings)
+{
+	check(CanAttach(InSettings));
+
+	// The thread is already idling, it picks the component up with the first frame after PlayFromFile
+	NesSettings = InSettings;
+	NesComponent = InNesComponent;
+	SetTraceNames();
+}
+
+void FEmulatorThreaded::SetTraceNames()
+{
+	const FString Name = NesComponent != nullptr ? NesComponent->GetName() : FString(TEXT("Pooled"));
+	ExecuteTraceName = FString::Printf(TEXT("UEnes Execute Frame %s"), *Name);
+	HandoffTraceName = FString::Printf(TEXT("UEnes Frame Handoff %s"), *Name);
+}
+
+Nes::Result FEmulatorThreaded::PlayFromFile(FString FileName, const TArray<uint8>* InitialState)
+{
+#if NES_SUPPORT_MULTIPLE_INSTANCES
+	// Keeps the thread from running a frame before the machine is set up and the initial state is restored
+	FScopeLock EmulationLock(&CoreCriticalSection);
+#endif
+	SetCallbacks();
 	bIsRunning = true;
 	CurrentGamePath = FileName;
 	FrameExecuteRate = 1.0 / FMath::Max(1.0, (double)NesSettings.FramesPerSecond);
@@ -187,37 +346,49 @@ Nes::Result FEmulatorThreaded::PlayFromFile(FString FileName)
 	Nes::Machine(*this).SetMode(Nes::Api::Machine::NTSC);
 	Nes::Machine(*this).Power(true);
 
-	Nes::Video::RenderState NESRenderState;
-	Nes::Video(*this).GetRenderState(NESRenderState);
-
-	NESRenderState.bits.count = 32;
-	NESRenderState.width = NesSettings.ScreenWidth;
-	NESRenderState.height = NesSettings.ScreenHeight;
-	NESRenderState.bits.mask.r = 0x000000ff;
-	NESRenderState.bits.mask.g = 0x0000ff00;
-	NESRenderState.bits.mask.b = 0x00ff0000;
-	NESRenderState.filter = Nes::Video::RenderState::FILTER_NONE;
-
-	Nes::Result VideoResult = Nes::Video(*this).SetRenderState(NESRenderState);
-	UE_LOG(LogUEnesVideo, Log, TEXT("Video init result: %d"), VideoResult);
-	
-	Nes::Sound NesSound(*this);
+	bVideoIndexed = NesSettings.bIndexedVideo && SetupIndexedPalette(*this, PaletteColors);
+	ApplyRenderState(*this, NesSettings, bVideoIndexed);
 	
-	NesSound.SetSampleRate(NesSettings.SampleRate);
-	NesSound.SetSpeaker(Nes::Api::Sound::Speaker::SPEAKER_MONO);
-	NesSound.SetVolume(1, 100);
+	ApplySoundSettings();
 
 	NumSamplesRequested = NesSettings.SamplesPerFrame;
 	
-	Nes::Input::Controllers::Pad::callback.Set(&PollPad, this);
-	Nes::Input::Controllers::Zapper::callback.Set(&PollZapper, this);
-
 	Nes::Api::Input(*this).ConnectController(1, Nes::Api::Input::Type::ZAPPER);
 	Nes::Api::Input(*this).ConnectController(0, Nes::Api::Input::Type::PAD1);
+
+	if (InitialState != nullptr)
+	{
+		istringstream StateStream(string(reinterpret_cast<const char*>(InitialState->GetData()), InitialState->Num()), ios::binary);
+
+		const Nes::Result StateResult = Nes::Machine(*this).LoadState(StateStream);
+		if (NES_FAILED(StateResult))
+		{
+			UE_LOG(LogUEnesTiming, Warning, TEXT("Failed to restore machine state: %d"), StateResult);
+		}
+	}
+
+	// The screen still shows the previous game, or the frame from before hibernating. Rows the new first frame happens
+	// to share with the last frame this instance emulated would otherwise never be sent
+	MarkAllRowsDirty();
 	
 	return result;
 }
 
+void FEmulatorThreaded::SetStagingPool(const FNesStagingPoolPtr& InPool)
+{
+	FScopeLock StagingPoolLock(&StagingPoolCriticalSection);
+	StagingPool = InPool;
+
+	// A new pool means a new screen texture, which starts out empty
+	MarkAllRowsDirty();
+}
+
+FNesStagingPoolPtr FEmulatorThreaded::GetStagingPool()
+{
+	FScopeLock StagingPoolLock(&StagingPoolCriticalSection);
+	return StagingPool;
+}
+
 Nes::Result FEmulatorThreaded::ExecuteFrame(bool bOutputVideo)
 {
 #if NES_SUPPORT_MULTIPLE_INSTANCES
@@ -225,16 +396,270 @@ Nes::Result FEmulatorThreaded::ExecuteFrame(bool bOutputVideo)
 #endif
 	Nes::Result Result;
 	NumSamplesRequested = FMath::Clamp(NumSamplesRequested, 0, NesSettings.SamplesPerFrame);
+	PrepareOutputs();
+	ApplyPendingCheats();
 	
-	if (bOutputVideo)
 	{
-		Result = Nes::Emulator::Execute(&VideoOutput, &SoundOutput, &Input);
+		SCOPE_CYCLE_COUNTER(STAT_NesExecuteFrame);
+		TRACE_CPUPROFILER_EVENT_SCOPE_TEXT(*ExecuteTraceName);
+
+		if (bOutputVideo)
+		{
+			Result = Nes::Emulator::Execute(&VideoOutput, &SoundOutput, &Input);
+		}
+		else
+		{
+			Result = Nes::Emulator::Execute(NULL, &SoundOutput, &Input);
+		}
 	}
-	else
+
+	ConvertSamplesToFloat();
+
+	if (bCaptureRam)
 	{
-		Result = Nes::Emulator::Execute(NULL, &SoundOutput, &Input);
+		RamBuffer.SetNumUninitialized(Nes::Cheats::RAM_SIZE);
+		FMemory::Memcpy(RamBuffer.GetData(), Nes::Cheats(*this).GetRam(), Nes::Cheats::RAM_SIZE);
 	}
 	
 	FrameNumber++;
+	NumFramesRun.Increment();
 	return Result;
 }
+
+void FEmulatorThreaded::PrepareOutputs()
+{
+	VideoOutput.pixels = VideoTarget ? VideoTarget : VideoBuffer.GetData();
+	VideoOutput.pitch = NesSettings.ScreenWidth * (bVideoIndexed ? sizeof(uint16) : 4);
+
+	SoundOutput.samples[0] = SampleBuffer.GetData();
+	SoundOutput.length[0] = NumSamplesRequested;
+	SoundOutput.samples[1] = NULL;
+	SoundOutput.length[1] = 0;
+
+	for (int32 i = 0; i < UE_ARRAY_COUNT(PadButtons); i++)
+	{
+		Input.pad[i].buttons = PadButtons[i];
+	}
+
+	Nes::Input::Controllers::Zapper& Zapper = Input.zapper;
+	Zapper.fire = bFireZapper;
+
+	if (Zapper.x != ~0U)
+	{
+		Zapper.x = ZapperX;
+		Zapper.y = ZapperY;
+	}
+	else if (Zapper.fire)
+	{
+		Zapper.x = ~1U;
+	}
+}
+
+void FEmulatorThreaded::ConvertSamplesToFloat()
+{
+	SCOPE_CYCLE_COUNTER(STAT_NesConvertAudio);
+
+	const int32 NumSamples = NumSamplesRequested * NesSettings.GetNumAudioChannels();
+	const int16* RESTRICT InSamples = SampleBuffer.GetData();
+	float* RESTRICT OutSamples = reinterpret_cast<float*>(AudioBuffer.GetData());
+
+	// Simple enough for the compiler to vectorize
+	for (int32 i = 0; i < NumSamples; i++)
+	{
+		OutSamples[i] = InSamples[i] * (1.f / 32768.f);
+	}
+}
+
+void FEmulatorThreaded::AddCheatCode(uint16 Address, uint8 Value)
+{
+	FPendingCheat Cheat;
+	Cheat.Code = Nes::Cheats::Code(Address, Value);
+	PendingCheats.Enqueue(Cheat);
+}
+
+void FEmulatorThreaded::ClearCheatCodes()
+{
+	FPendingCheat Cheat;
+	Cheat.bClear = true;
+	PendingCheats.Enqueue(Cheat);
+}
+
+void FEmulatorThreaded::ApplyPendingCheats()
+{
+	Nes::Cheats Cheats(*this);
+
+	FPendingCheat Cheat;
+	while (PendingCheats.Dequeue(Cheat))
+	{
+		if (Cheat.bClear)
+		{
+			Cheats.ClearCodes();
+		}
+		else if (NES_FAILED(Cheats.SetCode(Cheat.Code)))
+		{
+			UE_LOG(LogUEnesTiming, Warning, TEXT("Could not set cheat code %04X:%02X"), Cheat.Code.address, Cheat.Code.value);
+		}
+	}
+}
+
+void FEmulatorThreaded::UpdateDirtyRows(const uint8* Current)
+{
+	SCOPE_CYCLE_COUNTER(STAT_NesFindDirtyRows);
+
+	const int32 Pitch = NesSettings.ScreenWidth * (bVideoIndexed ? sizeof(uint16) : 4);
+	uint8* Previous = PreviousVideoBuffer.GetData();
+
+	if (bAllRowsDirty.AtomicSet(false))
+	{
+		DirtyRows.Init(true, NesSettings.ScreenHeight);
+	}
+
+	// Rows are only ever added here. They are cleared once the frame is handed off, so frames that aren't handed off
+	// carry their rows over to the next one
+	for (int32 Row = 0; Row < NesSettings.ScreenHeight; Row++)
+	{
+		const int32 Offset = Row * Pitch;
+		if (FMemory::Memcmp(Current + Offset, Previous + Offset, Pitch) != 0)
+		{
+			DirtyRows[Row] = true;
+			FMemory::Memcpy(Previous + Offset, Current + Offset, Pitch);
+		}
+	}
+}
+
+void FEmulatorThreaded::ApplyRenderState(Nes::Emulator& Emulator, const FNesSettings& Settings, bool bIndexed)
+{
+	Nes::Video::RenderState NESRenderState;
+	Nes::Video(Emulator).GetRenderState(NESRenderState);
+
+	NESRenderState.width = Settings.ScreenWidth;
+	NESRenderState.height = Settings.ScreenHeight;
+	NESRenderState.filter = Nes::Video::RenderState::FILTER_NONE;
+
+	if (bIndexed)
+	{
+		// The filter scales each channel of the index encoding palette to its mask: red's 0-255 fills the low byte as is,
+		// green's 0 or 255 becomes the single bit 8 and blue is always 0. Its lookup table then maps every palette entry
+		// to its own index, so no second pass over the frame is needed
+		NESRenderState.bits.count = 16;
+		NESRenderState.bits.mask.r = 0x00ff;
+		NESRenderState.bits.mask.g = 0x0100;
+		NESRenderState.bits.mask.b = 0xfe00;
+	}
+	else
+	{
+		NESRenderState.bits.count = 32;
+		NESRenderState.bits.mask.r = 0x000000ff;
+		NESRenderState.bits.mask.g = 0x0000ff00;
+		NESRenderState.bits.mask.b = 0x00ff0000;
+	}
+
+	Nes::Result VideoResult = Nes::Video(Emulator).SetRenderState(NESRenderState);
+	UE_LOG(LogUEnesVideo, Log, TEXT("Video init result: %d"), VideoResult);
+}
+
+void FEmulatorThreaded::UnsetCallbacks()
+{
+	Nes::Machine::eventCallback.Unset();
+	Nes::User::fileIoCallback.Unset();
+}
+
+Nes::Result FEmulatorThreaded::LoadHeadless(Nes::Emulator& Emulator, istream& Rom)
+{
+	{
+#if NES_SUPPORT_MULTIPLE_INSTANCES
+		FScopeLock EmulationLock(&CoreCriticalSection);
+#endif
+		UnsetCallbacks();
+
+		const Nes::Result Result = Nes::Machine(Emulator).Load(Rom, Nes::Machine::FAVORED_NES_NTSC, Nes::Machine::DONT_ASK_PROFILE);
+		if (NES_FAILED(Result))
+		{
+			return Result;
+		}
+
+		Nes::Machine(Emulator).SetMode(Nes::Machine::NTSC);
+		Nes::Machine(Emulator).Power(true);
+	}
+
+	Nes::Input(Emulator).ConnectController(0, Nes::Input::Type::PAD1);
+	return Nes::RESULT_OK;
+}
+
+void FEmulatorThreaded::UnloadHeadless(Nes::Emulator& Emulator)
+{
+#if NES_SUPPORT_MULTIPLE_INSTANCES
+	FScopeLock EmulationLock(&CoreCriticalSection);
+#endif
+	UnsetCallbacks();
+	Nes::Machine(Emulator).Unload();
+}
+
+Nes::Result FEmulatorThreaded::LoadStateHeadless(Nes::Emulator& Emulator, const TArray<uint8>& State)
+{
+	istringstream StateStream(string(reinterpret_cast<const char*>(State.GetData()), State.Num()), ios::binary);
+
+#if NES_SUPPORT_MULTIPLE_INSTANCES
+	FScopeLock EmulationLock(&CoreCriticalSection);
+#endif
+	UnsetCallbacks();
+	return Nes::Machine(Emulator).LoadState(StateStream);
+}
+
+Nes::Result FEmulatorThreaded::SaveStateToArray(Nes::Emulator& Emulator, TArray<uint8>& OutState, Nes::Machine::Compression Compression)
+{
+	ostringstream StateStream(ios::binary);
+
+	const Nes::Result Result = Nes::Machine(Emulator).SaveState(StateStream, Compression);
+	if (NES_SUCCEEDED(Result))
+	{
+		const string State = StateStream.str();
+		OutState.SetNumUninitialized(State.size());
+		FMemory::Memcpy(OutState.GetData(), State.data(), State.size());
+	}
+
+	return Result;
+}
+
+bool FEmulatorThreaded::SetupIndexedPalette(Nes::Emulator& Emulator, TArray<FColor>& OutPaletteColors)
+{
+	Nes::Video::Palette NesPalette = Nes::Video(Emulator).GetPalette();
+
+	// Capture the colors the machine would normally output
+	NesPalette.SetMode(NesPalette.GetDefaultMode());
+	Nes::Video::Palette::Colors Colors = NesPalette.GetColors();
+
+	OutPaletteColors.SetNum(Nes::Video::Palette::NUM_ENTRIES_EXT);
+	for (int32 i = 0; i < OutPaletteColors.Num(); i++)
+	{
+		OutPaletteColors[i] = FColor(Colors[i][0], Colors[i][1], Colors[i][2]);
+	}
+
+	// Replace it with a palette whose red channel holds the low eight bits of the entry's index and green is saturated
+	// for the upper 256 entries, so the 16-bit render state's one bit green mask keeps it. The extended palette
+	// includes the emphasis variants, so the core does not derive any colors from it
+	uint8 IndexColors[Nes::Video::Palette::NUM_ENTRIES_EXT][3];
+	for (int32 i = 0; i < Nes::Video::Palette::NUM_ENTRIES_EXT; i++)
+	{
+		IndexColors[i][0] = i & 0xFF;
+		IndexColors[i][1] = i >> 8 ? 0xFF : 0;
+		IndexColors[i][2] = 0;
+	}
+
+	NesPalette.SetCustom(IndexColors, Nes::Video::Palette::EXT_PALETTE);
+	NesPalette.SetMode(Nes::Video::Palette::MODE_CUSTOM);
+
+	// Brightness, saturation, contrast and hue are applied on top of custom palettes. Make sure they left the encoding intact
+	Colors = NesPalette.GetColors();
+	for (int32 i = 0; i < Nes::Video::Palette::NUM_ENTRIES_EXT; i++)
+	{
+		if (Colors[i][0] != IndexColors[i][0] || Colors[i][1] != IndexColors[i][1] || Colors[i][2] != 0)
+		{
+			UE_LOG(LogUEnesVideo, Warning, TEXT("Palette entry %d does not survive the core's color adjustments, falling back to RGBA video"), i);
+			NesPalette.SetMode(NesPalette.GetDefaultMode());
+			return false;
+		}
+	}
+
+	return true;
+}
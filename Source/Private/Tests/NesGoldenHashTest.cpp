@@ -0,0 +1,178 @@
+#include "NesTestUtils.h"
+
+#if WITH_DEV_AUTOMATION_TESTS
+
+#include "EmuCore/api/NstApiMovie.hpp"
+
+#include "Misc/AutomationTest.h"
+#include "Misc/Crc.h"
+#include "Misc/FileHelper.h"
+#include "Misc/Paths.h"
+
+#include <sstream>
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FNesGoldenHashTest, "UEnes.Core.GoldenHashes", EAutomationTestFlags::ApplicationContextMask | EAutomationTestFlags::ProductFilter)
+
+namespace
+{
+	const int32 GoldenSampleRate = 44100;
+	const int32 GoldenSamplesPerFrame = GoldenSampleRate / 60;
+	const int32 DefaultGoldenFrames = 600;
+
+	struct FFrameHashes
+	{
+		uint32 Video;
+		uint32 Audio;
+		uint32 Ram;
+
+		FString ToString() const
+		{
+			return FString::Printf(TEXT("%08x %08x %08x"), Video, Audio, Ram);
+		}
+	};
+
+	bool ParseGolden(const FString& Line, FFrameHashes& OutHashes)
+	{
+		TArray<FString> Fields;
+		Line.ParseIntoArrayWS(Fields);
+		if (Fields.Num() != 4)
+		{
+			return false;
+		}
+
+		OutHashes.Video = FParse::HexNumber(*Fields[1]);
+		OutHashes.Audio = FParse::HexNumber(*Fields[2]);
+		OutHashes.Ram = FParse::HexNumber(*Fields[3]);
+		return true;
+	}
+}
+
+// Runs every test ROM, driven by <Name>.nsv when there's a movie next to it, and compares CRCs of each frame's video,
+// audio and CPU RAM against <Name>.golden. Run with -UEnesUpdateGoldens to (re)write the golden files instead
+bool FNesGoldenHashTest::RunTest(const FString& Parameters)
+{
+	const TArray<FString> Roms = NesTest::FindRoms();
+	if (Roms.Num() == 0)
+	{
+		AddWarning(TEXT("No test ROMs found, pass -UEnesTestRoms=<Directory> or set RomDirectory in [UEnes.Tests]"));
+		return true;
+	}
+
+	const bool bUpdateGoldens = FParse::Param(FCommandLine::Get(), TEXT("UEnesUpdateGoldens"));
+	FNesSettings Settings;
+	const int32 FrameSize = Settings.ScreenWidth * Settings.ScreenHeight * 4;
+
+	for (const FString& Rom : Roms)
+	{
+		const FString RomName = FPaths::GetCleanFilename(Rom);
+		const FString GoldenPath = FPaths::ChangeExtension(Rom, TEXT("golden"));
+		const FString MoviePath = FPaths::ChangeExtension(Rom, TEXT("nsv"));
+
+		// Updating keeps the length of an existing golden file
+		TArray<FString> GoldenLines;
+		const bool bHasGolden = FFileHelper::LoadFileToStringArray(GoldenLines, *GoldenPath) && GoldenLines.Num() > 0;
+		if (!bHasGolden && !bUpdateGoldens)
+		{
+			AddWarning(FString::Printf(TEXT("%s has no golden file, run with -UEnesUpdateGoldens to create %s"), *RomName, *GoldenPath));
+			continue;
+		}
+
+		Nes::Emulator Emulator;
+		if (!NesTest::LoadRom(*this, Emulator, Rom))
+		{
+			NesTest::UnloadRom(Emulator);
+			continue;
+		}
+
+		Nes::Sound NesSound(Emulator);
+		NesSound.SetSampleRate(GoldenSampleRate);
+		NesSound.SetSpeaker(Nes::Api::Sound::Speaker::SPEAKER_MONO);
+
+		// The core reads the movie as it plays, so the stream has to outlive the frame loop
+		TArray<uint8> MovieData;
+		istringstream MovieStream(ios::binary);
+		if (FFileHelper::LoadFileToArray(MovieData, *MoviePath, FILEREAD_Silent))
+		{
+			MovieStream.str(string(reinterpret_cast<const char*>(MovieData.GetData()), MovieData.Num()));
+
+#if NES_SUPPORT_MULTIPLE_INSTANCES
+			FScopeLock EmulationLock(&FEmulatorThreaded::CoreCriticalSection);
+#endif
+			Nes::Movie::eventCallback.Unset();
+			FEmulatorThreaded::UnsetCallbacks();
+
+			if (NES_FAILED(Nes::Movie(Emulator).Play(MovieStream)))
+			{
+				AddError(FString::Printf(TEXT("%s: could not play %s"), *RomName, *MoviePath));
+			}
+		}
+
+		TArray<uint8> Frame;
+		TArray<int16> Samples;
+		Frame.SetNumZeroed(FrameSize);
+		Samples.SetNumZeroed(GoldenSamplesPerFrame);
+
+		Nes::Video::Output VideoOutput(Frame.GetData(), Settings.ScreenWidth * 4);
+		Nes::Sound::Output SoundOutput(Samples.GetData(), GoldenSamplesPerFrame);
+		Nes::Input::Controllers Input;
+
+		const int32 NumFrames = bHasGolden ? GoldenLines.Num() : DefaultGoldenFrames;
+		TArray<FString> NewGoldenLines;
+
+		for (int32 FrameIndex = 0; FrameIndex < NumFrames; FrameIndex++)
+		{
+			Emulator.Execute(&VideoOutput, &SoundOutput, &Input);
+
+			FFrameHashes Hashes;
+			Hashes.Video = FCrc::MemCrc32(Frame.GetData(), FrameSize);
+			Hashes.Audio = FCrc::MemCrc32(Samples.GetData(), Samples.Num() * sizeof(int16));
+			Hashes.Ram = FCrc::MemCrc32(Nes::Cheats(Emulator).GetRam(), Nes::Cheats::RAM_SIZE);
+
+			if (bUpdateGoldens)
+			{
+				NewGoldenLines.Add(FString::Printf(TEXT("%d %s"), FrameIndex, *Hashes.ToString()));
+				continue;
+			}
+
+			FFrameHashes Golden;
+			if (!ParseGolden(GoldenLines[FrameIndex], Golden))
+			{
+				AddError(FString::Printf(TEXT("%s line %d is malformed: \"%s\""), *GoldenPath, FrameIndex + 1, *GoldenLines[FrameIndex]));
+				break;
+			}
+
+			// Only the first divergence is interesting, every frame after it will differ as well
+			if (Hashes.Video != Golden.Video || Hashes.Audio != Golden.Audio || Hashes.Ram != Golden.Ram)
+			{
+				AddError(FString::Printf(TEXT("%s diverges at frame %d: video/audio/ram %s, golden %s"), *RomName, FrameIndex, *Hashes.ToString(), *Golden.ToString()));
+				break;
+			}
+		}
+
+		{
+#if NES_SUPPORT_MULTIPLE_INSTANCES
+			FScopeLock EmulationLock(&FEmulatorThreaded::CoreCriticalSection);
+#endif
+			Nes::Movie::eventCallback.Unset();
+			Nes::Movie(Emulator).Stop();
+		}
+
+		NesTest::UnloadRom(Emulator);
+
+		if (bUpdateGoldens)
+		{
+			if (FFileHelper::SaveStringArrayToFile(NewGoldenLines, *GoldenPath))
+			{
+				AddInfo(FString::Printf(TEXT("Wrote %d frames to %s"), NewGoldenLines.Num(), *GoldenPath));
+			}
+			else
+			{
+				AddError(FString::Printf(TEXT("Could not write %s"), *GoldenPath));
+			}
+		}
+	}
+
+	return true;
+}
+
+#endif
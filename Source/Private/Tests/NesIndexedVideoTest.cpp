@@ -0,0 +1,90 @@
+#include "NesTestUtils.h"
+
+#if WITH_DEV_AUTOMATION_TESTS
+
+#include "Misc/AutomationTest.h"
+#include "Misc/Paths.h"
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FNesIndexedVideoTest, "UEnes.Video.IndexedRoundTrip", EAutomationTestFlags::ApplicationContextMask | EAutomationTestFlags::ProductFilter)
+
+// Runs every test ROM twice, once with direct color output and once with the index encoding palette and 16-bit render
+// state, and checks that looking the indices up in the captured palette gives back the direct color frame
+bool FNesIndexedVideoTest::RunTest(const FString& Parameters)
+{
+	const TArray<FString> Roms = NesTest::FindRoms();
+	if (Roms.Num() == 0)
+	{
+		AddWarning(TEXT("No test ROMs found, pass -UEnesTestRoms=<Directory> or set RomDirectory in [UEnes.Tests]"));
+		return true;
+	}
+
+	const int32 NumFrames = 120;
+	FNesSettings Settings;
+	const int32 NumPixels = Settings.ScreenWidth * Settings.ScreenHeight;
+
+	for (const FString& Rom : Roms)
+	{
+		Nes::Emulator DirectEmulator;
+		Nes::Emulator IndexedEmulator;
+
+		if (NesTest::LoadRom(*this, DirectEmulator, Rom) && NesTest::LoadRom(*this, IndexedEmulator, Rom))
+		{
+			TArray<FColor> PaletteColors;
+			if (TestTrue(*FString::Printf(TEXT("%s accepts the index encoding palette"), *FPaths::GetCleanFilename(Rom)), FEmulatorThreaded::SetupIndexedPalette(IndexedEmulator, PaletteColors)))
+			{
+				FEmulatorThreaded::ApplyRenderState(IndexedEmulator, Settings, true);
+
+				TArray<uint8> DirectFrame;
+				TArray<uint16> Indices;
+				DirectFrame.SetNumZeroed(NumPixels * 4);
+				Indices.SetNumZeroed(NumPixels);
+
+				Nes::Video::Output DirectOutput(DirectFrame.GetData(), Settings.ScreenWidth * 4);
+				Nes::Video::Output IndexedOutput(Indices.GetData(), Settings.ScreenWidth * sizeof(uint16));
+				Nes::Input::Controllers Input;
+
+				bool bMatches = true;
+				for (int32 Frame = 0; Frame < NumFrames && bMatches; Frame++)
+				{
+					// Hold start now and then so games get past their title screen
+					Input.pad[0].buttons = (Frame / 30) % 2 ? Nes::Input::Controllers::Pad::START : 0;
+
+					DirectEmulator.Execute(&DirectOutput, NULL, &Input);
+					IndexedEmulator.Execute(&IndexedOutput, NULL, &Input);
+
+					const uint16* IndexData = Indices.GetData();
+
+					for (int32 Pixel = 0; Pixel < NumPixels; Pixel++)
+					{
+						// Bits the render state's masks should have cleared would point past the palette
+						if (!PaletteColors.IsValidIndex(IndexData[Pixel]))
+						{
+							AddError(FString::Printf(TEXT("%s frame %d pixel (%d, %d): index %d is outside the %d entry palette"),
+								*FPaths::GetCleanFilename(Rom), Frame, Pixel % Settings.ScreenWidth, Pixel / Settings.ScreenWidth, IndexData[Pixel], PaletteColors.Num()));
+							bMatches = false;
+							break;
+						}
+
+						const FColor& Decoded = PaletteColors[IndexData[Pixel]];
+						const uint8* Direct = DirectFrame.GetData() + Pixel * 4;
+
+						if (Decoded.R != Direct[0] || Decoded.G != Direct[1] || Decoded.B != Direct[2])
+						{
+							AddError(FString::Printf(TEXT("%s frame %d pixel (%d, %d): index %d decodes to %s, direct color output is (R=%d,G=%d,B=%d)"),
+								*FPaths::GetCleanFilename(Rom), Frame, Pixel % Settings.ScreenWidth, Pixel / Settings.ScreenWidth, IndexData[Pixel], *Decoded.ToString(), Direct[0], Direct[1], Direct[2]));
+							bMatches = false;
+							break;
+						}
+					}
+				}
+			}
+		}
+
+		NesTest::UnloadRom(DirectEmulator);
+		NesTest::UnloadRom(IndexedEmulator);
+	}
+
+	return true;
+}
+
+#endif
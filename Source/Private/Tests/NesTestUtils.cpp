@@ -0,0 +1,68 @@
+#include "NesTestUtils.h"
+
+#if WITH_DEV_AUTOMATION_TESTS
+
+#include "Misc/AutomationTest.h"
+#include "Misc/ConfigCacheIni.h"
+#include "Misc/FileHelper.h"
+#include "Misc/Paths.h"
+#include "HAL/FileManager.h"
+
+#include <sstream>
+
+FString NesTest::GetRomDirectory()
+{
+	FString Directory;
+	if (!FParse::Value(FCommandLine::Get(), TEXT("UEnesTestRoms="), Directory))
+	{
+		GConfig->GetString(TEXT("UEnes.Tests"), TEXT("RomDirectory"), Directory, GGameIni);
+	}
+	return Directory;
+}
+
+TArray<FString> NesTest::FindRoms()
+{
+	TArray<FString> Roms;
+	const FString Directory = GetRomDirectory();
+	if (Directory.IsEmpty())
+	{
+		return Roms;
+	}
+
+	IFileManager::Get().FindFiles(Roms, *FPaths::Combine(Directory, TEXT("*.nes")), true, false);
+	Roms.Sort();
+
+	for (FString& Rom : Roms)
+	{
+		Rom = FPaths::Combine(Directory, Rom);
+	}
+	return Roms;
+}
+
+bool NesTest::LoadRom(FAutomationTestBase& Test, Nes::Emulator& Emulator, const FString& RomPath)
+{
+	TArray<uint8> RomData;
+	if (!FFileHelper::LoadFileToArray(RomData, *RomPath))
+	{
+		Test.AddError(FString::Printf(TEXT("Could not read %s"), *RomPath));
+		return false;
+	}
+
+	istringstream RomStream(string(reinterpret_cast<const char*>(RomData.GetData()), RomData.Num()), ios::binary);
+
+	if (NES_FAILED(FEmulatorThreaded::LoadHeadless(Emulator, RomStream)))
+	{
+		Test.AddError(FString::Printf(TEXT("Could not load %s"), *RomPath));
+		return false;
+	}
+
+	FEmulatorThreaded::ApplyRenderState(Emulator, FNesSettings());
+	return true;
+}
+
+void NesTest::UnloadRom(Nes::Emulator& Emulator)
+{
+	FEmulatorThreaded::UnloadHeadless(Emulator);
+}
+
+#endif
@@ -0,0 +1,26 @@
+#pragma once
+
+#include "CoreMinimal.h"
+
+#if WITH_DEV_AUTOMATION_TESTS
+
+#include "NesThread.h"
+
+class FAutomationTestBase;
+
+namespace NesTest
+{
+	// Set with -UEnesTestRoms=<Directory> or RomDirectory in the [UEnes.Tests] section of the game ini
+	FString GetRomDirectory();
+
+	// Every .nes file in the test ROM directory, sorted by name
+	TArray<FString> FindRoms();
+
+	// Loads RomPath into Emulator and powers it on with the plugin's render state and a pad in port 1
+	bool LoadRom(FAutomationTestBase& Test, Nes::Emulator& Emulator, const FString& RomPath);
+
+	// Unloads the game while no FEmulatorThreaded can receive the machine and battery callbacks it fires
+	void UnloadRom(Nes::Emulator& Emulator);
+}
+
+#endif
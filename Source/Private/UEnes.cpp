@@ -2,6 +2,8 @@
 
 #include "UEnes.h"
 #include "EmuCore/Api/NstAPI.hpp"
+#include "AudioMixerTypes.h"
+#include "GenericPlatform/GenericPlatformProperties.h"
 
 #define LOCTEXT_NAMESPACE "UEnesModule"
 
@@ -9,6 +11,11 @@ DEFINE_LOG_CATEGORY(LogUEnesTiming);
 DEFINE_LOG_CATEGORY(LogUEnesVideo);
 DEFINE_LOG_CATEGORY(LogUEnesAudio);
 
+void FNesSettings::InitializeAudioSettings()
+{
+	SampleRate = FAudioPlatformSettings::GetPlatformSettings(FPlatformProperties::GetRuntimeSettingsClassName()).SampleRate;
+	SamplesPerFrame = FMath::RoundToInt32((double)SampleRate / (double)FramesPerSecond);
+}
 
 void FUEnesModule::StartupModule()
 {
@@ -0,0 +1,103 @@
+#pragma once
+
+#include "UEnes.h"
+#include "EmuCore/api/NstApiEmulator.hpp"
+#include "EmuCore/api/NstApiInput.hpp"
+#include "EmuCore/api/NstApiVideo.hpp"
+
+// A RAM location whose change in value between steps contributes to an environment's reward
+struct FNesRewardAddress
+{
+	// Only the 2 KB of internal CPU RAM ($0000-$07FF) can be read, Api::Cheats doesn't expose cartridge WRAM at $6000-$7FFF.
+	// The environment refuses to start if any byte of the value lies outside it
+	uint16 Address = 0;
+
+	// Number of little endian bytes that make up the value, 1 to 4
+	int32 NumBytes = 1;
+
+	float Scale = 1.f;
+};
+
+struct FNesBatchSettings
+{
+	FString RomPath;
+
+	int32 NumEnvironments = 1;
+
+	// Frames emulated per step with the same action held. Only the last one renders video
+	int32 FrameSkip = 4;
+
+	// Frames run after power on before the reset snapshot is taken
+	int32 WarmupFrames = 0;
+
+	// If non-zero, observations include an 8-bit luminance image sampled every DownsampleFactor pixels in both directions
+	int32 DownsampleFactor = 0;
+
+	// If true, observations include the 2 KB of CPU RAM
+	bool bObserveRam = true;
+
+	TArray<FNesRewardAddress> RewardAddresses;
+};
+
+/**
+ * Runs a batch of headless emulators running the same game in lock step, for training agents.
+ * Each Step applies one pad 1 button mask per environment, runs FrameSkip frames on every environment in parallel
+ * and writes the observations of all environments contiguously into a caller provided buffer, along with rewards
+ * computed from the configured RAM addresses. Environments can be reset to a shared snapshot individually.
+ */
+class UENES_API FNesBatchEnvironment
+{
+public:
+	explicit FNesBatchEnvironment(const FNesBatchSettings& InSettings);
+	~FNesBatchEnvironment();
+
+	// False if the ROM failed to load or a reward address is outside CPU RAM
+	bool IsValid() const { return Environments.Num() > 0; }
+
+	int32 GetNumEnvironments() const { return Environments.Num(); }
+
+	// Bytes written to the observation buffer per environment
+	int32 GetObservationSize() const;
+
+	/* Runs one step on every environment.
+	 * Actions holds one Nes::Input::Controllers::Pad button mask per environment. Observations must hold GetObservationSize() bytes
+	 * per environment and Rewards one float per environment. Either output may be null.
+	 */
+	void Step(const uint8* Actions, uint8* Observations, float* Rewards);
+
+	// Restores the given environments to the reset snapshot and writes their observations at their slots in Observations, if given
+	void Reset(const TArray<int32>& EnvironmentIndices, uint8* Observations);
+
+	// Replaces the reset snapshot with the current state of an environment
+	bool CaptureSnapshot(int32 EnvironmentIndex);
+
+	double GetStepsPerSecond() const;
+
+private:
+	struct FEnvironment
+	{
+		Nes::Api::Emulator Emulator;
+		Nes::Api::Video::Output VideoOutput;
+		Nes::Api::Input::Controllers Input;
+		TArray<uint8> Frame;
+		TArray<int64> RewardValues;
+	};
+
+	void RunFrames(FEnvironment& Environment, uint8 Action);
+	void WriteObservation(FEnvironment& Environment, uint8* Observation) const;
+	float UpdateReward(FEnvironment& Environment) const;
+	int64 ReadRewardValue(FEnvironment& Environment, const FNesRewardAddress& RewardAddress) const;
+	void UnloadAll();
+
+	FNesBatchSettings Settings;
+	FNesSettings ScreenSettings;
+
+	TArray<TUniquePtr<FEnvironment>> Environments;
+	TArray<uint8> Snapshot;
+
+	// Frame rendered when Snapshot was taken, save states don't include it
+	TArray<uint8> SnapshotFrame;
+
+	int64 NumSteps = 0;
+	double StepSeconds = 0;
+};
@@ -4,6 +4,8 @@
 #include "Components/ActorComponent.h"
 #include "Engine/Texture2D.h"
 #include "NesSoundStream.h"
+#include "NesScreenUploader.h"
+#include "NesRamSearch.h"
 #include "Containers/CircularQueue.h"
 #include "NesComponent.generated.h"
 
@@ -23,6 +25,28 @@ public:
 };
 
 
+USTRUCT(BlueprintType)
+struct FNesFrameStats
+{
+	GENERATED_BODY()
+public:
+	// Frames executed by the emulator
+	UPROPERTY(BlueprintReadOnly)
+	int32 FramesRun = 0;
+
+	// Frames whose video made it to the screen texture
+	UPROPERTY(BlueprintReadOnly)
+	int32 FramesPresented = 0;
+
+	// Frames handed to the component whose video was dropped
+	UPROPERTY(BlueprintReadOnly)
+	int32 FramesSkipped = 0;
+
+	// Samples per channel waiting in the sound stream
+	UPROPERTY(BlueprintReadOnly)
+	int32 AudioQueuedSamples = 0;
+};
+
 UENUM(BlueprintType)
 enum class PadButton : uint8
 {
@@ -37,6 +61,8 @@ enum class PadButton : uint8
 };
 
 class FEmulatorThreaded;
+class UTexture2DArray;
+class UMaterialInterface;
 
 UCLASS(BlueprintType, Config=Game, meta = (BlueprintSpawnableComponent))
 class UENES_API UNesComponent : public UActorComponent
@@ -47,14 +73,15 @@ public:
 	virtual void BeginPlay() override;
 	virtual void EndPlay(const EEndPlayReason::Type EndPlayReason) override;
 
-	void FrameReadyCallback(const TArray<uint8>& VideoData, const TArray<uint8>& AudioData, int32 AudioByteCount);
+	void FrameReadyCallback(const FNesStagingPoolPtr& Pool, int32 BufferIndex, const FNesDirtyRows& DirtyRows, const TArray<uint8>& AudioData, const TArray<uint8>& RamData, int32 AudioByteCount);
 	void PostExecuteFrame(int32 AudioByteCount);
 		
 protected:
 	int FrameNumber = 0;
 	FEmulatorThreaded* EmulationTickThread = nullptr;
 
-	void CreateScreenTexture();
+	void CreateScreenTexture(bool bIndexed);
+	void UpdatePaletteTexture(const TArray<FColor>& Colors);
 
 	UFUNCTION(BlueprintCallable)
 	void PowerOff();
@@ -62,6 +89,39 @@ protected:
 	UFUNCTION(BlueprintCallable)
 	void PlayFromFile(FString FileName);
 
+	void StartEmulation(const FString& FileName, const TArray<uint8>* InitialState);
+
+	// Time the last game was started, used to report the time to its first frame
+	double PlayRequestTime = 0;
+
+	// Insights scope for FrameReadyCallback, which covers the audio queueing and texture upload of this instance
+	FString FrameReadyTraceName;
+
+	/* Saves the running game's machine state into a compressed blob and frees the emulator and its thread.
+	 * The screen keeps showing the last frame until Resume is called.
+	 */
+	UFUNCTION(BlueprintCallable)
+	bool Hibernate();
+
+	// Recreates the emulator and restores the state saved by Hibernate
+	UFUNCTION(BlueprintCallable)
+	bool Resume();
+
+	UFUNCTION(BlueprintPure)
+	bool IsHibernating() const { return bHibernating; }
+
+	// Seconds the owner has to go unrendered before the emulator is hibernated automatically, 0 disables it. It is resumed once the owner is rendered again
+	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "Emulation")
+	float HibernateAfterSecondsUnseen = 0.f;
+
+	void UpdateHibernation();
+
+	FTimerHandle HibernationTimerHandle;
+	bool bHibernating = false;
+	TArray<uint8> HibernatedState;
+	uint32 HibernatedPadButtons[4] = { 0, 0, 0, 0 };
+	FString CurrentGamePath;
+
 	UFUNCTION(BlueprintCallable)
 	void PullZapperTrigger();
 
@@ -72,6 +132,38 @@ protected:
 	UPROPERTY(BlueprintReadOnly, Transient)
 	UTexture2D* ScreenTexture;
 
+	// 512x1 lookup of the machine's palette including emphasis, indexed by ScreenTexture's texels when NesSettings.bIndexedVideo is enabled
+	UPROPERTY(BlueprintReadOnly, Transient)
+	UTexture2D* PaletteTexture;
+
+	// True if ScreenTexture is an R16_UINT palette index texture
+	bool bScreenTextureIndexed = false;
+
+	/* Material that decodes the palette indices in ScreenTexture through PaletteTexture, see the README.
+	 * NesSettings.bIndexedVideo is ignored unless this is set, since M_UEnesScreen only displays RGBA screens.
+	 */
+	UPROPERTY(BlueprintReadOnly, EditAnywhere, AdvancedDisplay, Category = "Emulation")
+	UMaterialInterface* IndexedScreenMaterial;
+
+	// Returns IndexedScreenMaterial if the screen is indexed, otherwise RGBAMaterial
+	UFUNCTION(BlueprintPure)
+	UMaterialInterface* GetScreenMaterial(UMaterialInterface* RGBAMaterial) const;
+
+	/* If true the screen is written to a slice of the world's shared screen array (UNesScreenSubsystem) instead of ScreenTexture.
+	 * All shared screens are uploaded with one render command per frame, which helps levels with many cabinets.
+	 * The screen material has to sample SharedScreenTexture at SharedScreenSlice.
+	 */
+	UPROPERTY(BlueprintReadOnly, EditAnywhere, AdvancedDisplay)
+	bool bUseSharedScreenArray = false;
+
+	UPROPERTY(BlueprintReadOnly, Transient)
+	UTexture2DArray* SharedScreenTexture;
+
+	UPROPERTY(BlueprintReadOnly, Transient)
+	int32 SharedScreenSlice = INDEX_NONE;
+
+	void ReleaseSharedScreenSlice();
+
 	UPROPERTY(BlueprintReadOnly, Transient)
 	UNesSoundStream* NesSoundStream;
 
@@ -81,14 +173,13 @@ protected:
 	UPROPERTY(BlueprintReadWrite, EditAnywhere)
 	bool bPlayWhiteNoiseWhenOff = false;
 
-	/* If true the render target will be updated on the render thread.  
-	 * Updating on the render thread may result in some input delay. While updating in the game thread feels better, it seems
-	 * to cause the render thread to be flushed every time the emulator runs a cycle.
+	/* Deprecated, kept for existing Blueprints. The screen texture is always updated on the render thread through ScreenUploader.
+	 * The old game thread path recreated the texture resource every frame, which flushed the render thread.
 	 */
-	UPROPERTY(BlueprintReadOnly, EditAnywhere, AdvancedDisplay)
+	UPROPERTY(BlueprintReadOnly, meta = (DeprecatedProperty, DeprecationMessage = "The screen texture is always updated on the render thread, this has no effect"))
 	bool bUpdateVideoOnRenderThread = true;
 
-	UFUNCTION(BlueprintCallable)
+	UFUNCTION(BlueprintCallable, meta = (DeprecatedFunction, DeprecationMessage = "The screen texture is always updated on the render thread, this has no effect"))
 	void SetUpdateVideoOnRenderThread(bool bNewValue);
 	
 	UFUNCTION(BlueprintCallable)
@@ -100,8 +191,47 @@ protected:
 	UFUNCTION(BlueprintCallable)
 	void ResetAudioBuffer();
 
+	UFUNCTION(BlueprintPure)
+	FNesFrameStats GetFrameStats() const;
+
+	// Starts a cheat search with every CPU RAM address as a candidate. RAM is copied out with every frame until EndRamSearch
+	UFUNCTION(BlueprintCallable)
+	void BeginRamSearch();
+
+	UFUNCTION(BlueprintCallable)
+	void EndRamSearch();
+
+	/* Keeps the addresses whose value passes Compare since the last filter (or BeginRamSearch) and returns how many are left.
+	 * Value is only used by EqualTo, IncreasedBy and DecreasedBy.
+	 */
+	UFUNCTION(BlueprintCallable)
+	int32 FilterRamSearch(ENesRamCompare Compare, int32 Value);
+
+	UFUNCTION(BlueprintCallable)
+	TArray<int32> GetRamSearchResults(int32 MaxResults = 64) const;
+
+	// Value of a CPU RAM address in the last frame captured by the RAM search
+	UFUNCTION(BlueprintPure)
+	int32 GetRamSearchValue(int32 Address) const;
+
+	TUniquePtr<FNesRamSearch> RamSearch;
+
+	// Makes reads of Cheat.Address return Cheat.Value. Cheats are kept across Hibernate and PlayFromFile
+	UFUNCTION(BlueprintCallable)
+	void AddCheat(const FCheatCode& Cheat);
+
+	UFUNCTION(BlueprintCallable)
+	void ClearCheats();
+
+	UPROPERTY(BlueprintReadOnly, Transient)
+	TArray<FCheatCode> ActiveCheats;
+
+	int32 NumFramesPresented = 0;
+	int32 NumFramesSkipped = 0;
+
+	TUniquePtr<FNesScreenUploader> ScreenUploader;
+
 public:
-	TArray<uint8> VideoBuffer;
 #if	NES_USE_AUDIO_QUEUE
 	TCircularQueue<uint8>AudioBuffer = TCircularQueue<uint8>(100600);
 	int32 AudioFramesToBuffer = 4;
@@ -0,0 +1,41 @@
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Subsystems/WorldSubsystem.h"
+#include "Async/Future.h"
+#include "NesEmulatorPoolSubsystem.generated.h"
+
+class FEmulatorThreaded;
+class UNesComponent;
+struct FNesSettings;
+
+/**
+ * Keeps a number of idle emulators ready so PlayFromFile doesn't have to create the thread, the machine, the palette
+ * and the filter on the game thread. Instances are created on background threads when the world begins play and
+ * the pool is topped up in the background whenever one is checked out.
+ */
+UCLASS(Config=Game)
+class UENES_API UNesEmulatorPoolSubsystem : public UWorldSubsystem
+{
+	GENERATED_BODY()
+
+public:
+	// UWorldSubsystem
+	virtual bool DoesSupportWorldType(const EWorldType::Type WorldType) const override;
+	virtual void OnWorldBeginPlay(UWorld& InWorld) override;
+	virtual void Deinitialize() override;
+
+	// Returns an idle emulator attached to NesComponent, or null if none matches Settings' buffer layout
+	FEmulatorThreaded* Checkout(UNesComponent* NesComponent, const FNesSettings& Settings);
+
+protected:
+	// Number of idle emulators kept ready. They use the default FNesSettings, components with a different buffer layout create their own
+	UPROPERTY(Config)
+	int32 NumPrewarmedEmulators = 0;
+
+	void PrewarmAsync(int32 Count);
+
+	FCriticalSection PoolCriticalSection;
+	TArray<FEmulatorThreaded*> IdleEmulators;
+	TArray<TFuture<void>> PendingPrewarms;
+};
@@ -0,0 +1,69 @@
+#pragma once
+
+#include "UEnes.h"
+#include "NesRamSearch.generated.h"
+
+UENUM(BlueprintType)
+enum class ENesRamCompare : uint8
+{
+	// Current value equals Value
+	EqualTo,
+	// Current value differs from the previous snapshot
+	Changed,
+	Unchanged,
+	// Current value is greater than the previous snapshot
+	Increased,
+	Decreased,
+	// Current value is exactly Value more than the previous snapshot, wrapping at 256
+	IncreasedBy,
+	DecreasedBy
+};
+
+/**
+ * Cheat finder over the 2 KB of CPU RAM. Every Filter compares the latest snapshot against the one taken at the
+ * previous Filter (or Reset) and drops the addresses that don't match. Candidates are kept as a bitset and the
+ * comparisons run 16 bytes at a time, so a full pass over RAM costs well under a microsecond.
+ * Cartridge WRAM isn't exposed through Api::Cheats, so only addresses $0000-$07FF can be searched.
+ */
+class UENES_API FNesRamSearch
+{
+public:
+	static constexpr int32 RamSize = 0x800;
+
+	FNesRamSearch();
+
+	// Marks every address as a candidate and takes the current snapshot as the baseline
+	void Reset();
+
+	// Copies RamSize bytes of CPU RAM as the current snapshot
+	void Update(const uint8* Ram);
+
+	// Drops the candidates that don't match, then makes the current snapshot the baseline. Returns the candidates left
+	int32 Filter(ENesRamCompare Compare, uint8 Value = 0);
+
+	int32 GetNumCandidates() const;
+
+	// Appends up to MaxResults candidate addresses in ascending order
+	void GetCandidates(TArray<int32>& OutAddresses, int32 MaxResults) const;
+
+	uint8 GetValue(int32 Address) const
+	{
+		return Current[Address & (RamSize - 1)];
+	}
+
+	bool HasSnapshot() const { return bHasSnapshot; }
+
+private:
+	static constexpr int32 NumWords = RamSize / 64;
+
+	template<ENesRamCompare Compare>
+	void FilterWords(uint8 Value);
+
+	alignas(64) uint8 Current[RamSize];
+	alignas(64) uint8 Previous[RamSize];
+
+	// One bit per address, set while the address is still a candidate
+	uint64 Candidates[NumWords];
+
+	bool bHasSnapshot = false;
+};
@@ -0,0 +1,75 @@
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Subsystems/WorldSubsystem.h"
+#include "NesScreenUploader.h"
+#include "NesScreenSubsystem.generated.h"
+
+class UTexture2D;
+class UTexture2DArray;
+
+/**
+ * Owns a texture array shared by every NesComponent that opts into it, one slice per screen.
+ * Components hand over the staging buffer of their latest frame. Once per world tick a single render command writes the
+ * changed rows of every slice to a staging texture with a region per slice, then copies each slice's changed span into
+ * the array, instead of one texture and one render command per component. Frames are never copied on the game thread.
+ */
+UCLASS(Config=Game)
+class UENES_API UNesScreenSubsystem : public UTickableWorldSubsystem
+{
+	GENERATED_BODY()
+
+public:
+	// UTickableWorldSubsystem
+	virtual void Deinitialize() override;
+	virtual void Tick(float DeltaTime) override;
+	virtual TStatId GetStatId() const override;
+
+	// Returns a free slice, or INDEX_NONE if the array is full or was created with a different screen format
+	int32 AcquireSlice(int32 InWidth, int32 InHeight, bool bIndexed);
+	void ReleaseSlice(int32 Slice);
+
+	/* Takes over the staging buffer BufferIndex of Pool as Slice's latest frame, releasing the one it replaces. The rows
+	 * flagged in DirtyRows, or every row for the slice's first frame, are uploaded from it on the next tick.
+	 */
+	void SubmitFrame(int32 Slice, const FNesStagingPoolPtr& Pool, int32 BufferIndex, const FNesDirtyRows& DirtyRows);
+
+	UTexture2DArray* GetScreenArray() const { return ScreenArray; }
+
+protected:
+	// Number of slices in the shared array. The array can't grow once materials are sampling it. Also limited by the
+	// staging texture, which stacks one region per slice and can't be taller than the RHI's largest 2D texture
+	UPROPERTY(Config)
+	int32 MaxScreens = 64;
+
+	UPROPERTY(Transient)
+	UTexture2DArray* ScreenArray;
+
+	/* Height * MaxScreens tall, slice i's rows live at i * Height. Updated with the changed rows on the render thread, then
+	 * copied into the array. Texture arrays can't be partially updated directly and locking a slice flushes the RHI thread.
+	 * Every upload goes through it, so each region always mirrors its slice and can be copied across unchanged rows.
+	 */
+	UPROPERTY(Transient)
+	UTexture2D* StagingTexture;
+
+	struct FSlice
+	{
+		bool bInUse = false;
+
+		// The component's staging buffer holding the slice's latest frame, INDEX_NONE once it's been uploaded
+		FNesStagingPoolPtr Pool;
+		int32 BufferIndex = INDEX_NONE;
+
+		// Rows that haven't been uploaded yet. Starts out all set since the slice is created without data
+		FNesDirtyRows PendingRows;
+	};
+
+	// Hands the slice's buffer back to its pool
+	void ReleaseFrame(FSlice& Slice);
+
+	TArray<FSlice> Slices;
+
+	int32 Width = 0;
+	int32 Height = 0;
+	int32 BytesPerPixel = 0;
+};
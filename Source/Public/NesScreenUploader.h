@@ -0,0 +1,77 @@
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Containers/Queue.h"
+
+class UTexture2D;
+
+// One bit per screen row, set for rows that changed since the previous frame
+typedef TBitArray<TInlineAllocator<8>> FNesDirtyRows;
+
+/**
+ * Whole-frame buffers passed between an emulator thread, the game thread and the render thread.
+ * The emulator thread takes a free buffer, writes its frame straight into it and hands the index over. Whoever
+ * consumes the frame releases the buffer.
+ */
+class FNesStagingPool
+{
+public:
+	// One being written by the emulator, one or two waiting on the game thread and one being read by the render thread
+	static constexpr int32 NumBuffers = 4;
+
+	explicit FNesStagingPool(int32 InFrameSize);
+
+	// Returns INDEX_NONE if every buffer is in use. Only the emulator thread feeding the pool may call this
+	int32 Acquire();
+	void Release(int32 BufferIndex);
+
+	uint8* GetBuffer(int32 BufferIndex) { return Buffers[BufferIndex].GetData(); }
+	int32 GetFrameSize() const { return FrameSize; }
+
+private:
+	TArray<uint8> Buffers[NumBuffers];
+	int32 FrameSize;
+
+	// Released from the game and render threads, acquired by the emulator thread
+	TQueue<int32, EQueueMode::Mpsc> FreeBuffers;
+};
+
+typedef TSharedPtr<FNesStagingPool, ESPMode::ThreadSafe> FNesStagingPoolPtr;
+
+/**
+ * Streams emulator frames into a persistent screen texture.
+ * The texture resource is created once. Frames arrive in buffers of the uploader's staging pool and the changed rows
+ * are written as one UpdateTexture2D per contiguous row range on the render thread, which releases the buffer
+ * afterwards. Frames are never copied on the game thread, nothing is recreated and the render thread is never flushed.
+ */
+class FNesScreenUploader
+{
+public:
+	FNesScreenUploader(int32 InWidth, int32 InHeight, int32 InBytesPerPixel);
+
+	/* Enqueues an upload of the rows flagged in DirtyRows from the staging buffer BufferIndex to Texture and takes over the buffer.
+	 * Identical frames upload nothing. Returns false if the texture has no resource yet, in which case the dirty rows are carried over to the next frame.
+	 */
+	bool UploadFrame(UTexture2D* Texture, int32 BufferIndex, const FNesDirtyRows& DirtyRows);
+
+	const FNesStagingPoolPtr& GetStagingPool() const { return Pool; }
+
+	int32 GetFrameSize() const { return Width * Height * BytesPerPixel; }
+	int32 GetNumDroppedFrames() const { return NumDroppedFrames; }
+	uint64 GetNumUploadedBytes() const { return NumUploadedBytes; }
+
+private:
+	FNesStagingPoolPtr Pool;
+
+	int32 Width;
+	int32 Height;
+	int32 BytesPerPixel;
+	int32 NumDroppedFrames = 0;
+
+	// Rows that still have to be uploaded. Starts out all set since the texture is created without data
+	FNesDirtyRows PendingRows;
+
+	uint64 NumUploadedBytes = 0;
+	uint64 NumUploadedBytesAtLastReport = 0;
+	double LastReportTime = 0;
+};
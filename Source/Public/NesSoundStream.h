@@ -24,7 +24,10 @@ public:
 	
 	UFUNCTION()
 	void StreamWhiteNoise();
-	void StreamGameAudio(float SamplesPerFrame);
+	void StreamGameAudio(float SamplesPerFrame, int32 InNumChannels);
+
+	// The mixer reads the channel count when the sound starts, so this has to be called before the stream is played
+	void SetNumChannels(int32 InNumChannels);
 	
 	UPROPERTY(EditAnywhere, BlueprintReadWrite)
 	float NoiseVolume;
@@ -35,7 +38,8 @@ public:
 	//virtual void OnEndGenerate() override;
 	virtual Audio::EAudioMixerStreamDataFormat::Type GetGeneratedPCMDataFormat() const override 
 	{ 
-		return bGenerateWhiteNoise ? Audio::EAudioMixerStreamDataFormat::Float : Audio::EAudioMixerStreamDataFormat::Int16;		
+		// Game audio is converted to float on the emulator thread so the mixer can consume it as is
+		return Audio::EAudioMixerStreamDataFormat::Float;
 	}
 	/** End USoundWave */
 
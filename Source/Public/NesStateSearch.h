@@ -0,0 +1,87 @@
+#pragma once
+
+#include "UEnes.h"
+#include "EmuCore/api/NstApiEmulator.hpp"
+#include "EmuCore/api/NstApiInput.hpp"
+
+struct FNesStateSearchSettings
+{
+	FString RomPath;
+
+	// Machine state to search from, as written by Machine::SaveState. Empty searches from power on
+	TArray<uint8> RootState;
+
+	// Pad 1 button masks tried from every state
+	TArray<uint8> Actions;
+
+	// Frames each action is held for
+	int32 FramesPerAction = 4;
+
+	int32 MaxDepth = 60;
+
+	// States kept per depth, ranked by Score. 0 keeps every state (breadth first search)
+	int32 BeamWidth = 1024;
+
+	// Emulators searching in parallel, 0 uses one per task graph worker
+	int32 NumWorkers = 0;
+
+	// Goal, Prune and Score are called concurrently from the ParallelFor workers, one call per worker at a time, so they
+	// must be thread safe and shouldn't touch UObjects or other game thread state
+
+	// Called with the 2 KB of CPU RAM after every action. The search stops at the first state satisfying Goal
+	TFunction<bool(const uint8*)> Goal;
+
+	// States for which Prune returns true are dropped
+	TFunction<bool(const uint8*)> Prune;
+
+	// Higher scoring states are kept when the beam is full
+	TFunction<float(const uint8*)> Score;
+};
+
+struct FNesStateSearchResult
+{
+	bool bFound = false;
+
+	// Actions (indices into FNesStateSearchSettings::Actions) leading from the root to the goal
+	TArray<uint8> Path;
+
+	// Machine state at the goal
+	TArray<uint8> State;
+
+	int64 StatesExplored = 0;
+	double Seconds = 0;
+};
+
+/**
+ * Searches the input sequences reachable from a machine state for one that satisfies a RAM predicate.
+ * Each worker owns an emulator and expands its share of the frontier by restoring a state, holding an action for a
+ * few frames and saving the resulting state. States with identical CPU RAM are only expanded once.
+ */
+class UENES_API FNesStateSearch
+{
+public:
+	explicit FNesStateSearch(const FNesStateSearchSettings& InSettings);
+	~FNesStateSearch();
+
+	FNesStateSearchResult Run();
+
+private:
+	struct FNode
+	{
+		TArray<uint8> State;
+		TArray<uint8> Path;
+		float Score = 0.f;
+	};
+
+	struct FWorker
+	{
+		Nes::Api::Emulator Emulator;
+		Nes::Api::Input::Controllers Input;
+	};
+
+	bool Expand(FWorker& Worker, const FNode& Parent, uint8 ActionIndex, FNode& OutChild, uint64& OutRamHash, bool& bOutGoal) const;
+	void UnloadAll();
+
+	FNesStateSearchSettings Settings;
+	TArray<TUniquePtr<FWorker>> Workers;
+};
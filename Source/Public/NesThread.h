@@ -9,9 +9,13 @@
 #include "EmuCore/api/NstApiCheats.hpp"
 
 #include "UEnes.h"
+#include "NesScreenUploader.h"
 #include "Misc/ScopeLock.h"
+#include "Containers/Queue.h"
+#include "HAL/ThreadSafeBool.h"
 
 #include <fstream>
+#include <sstream>
 
 using namespace std;
 
@@ -25,6 +29,8 @@ class UNesComponent;
 class FEmulatorThreaded : public FRunnable, public Nes::Emulator
 {
 public:
+	// InNesComponent may be null for pooled instances, which are attached to a component later with AttachComponent.
+	// The emulation thread is started either way and idles until PlayFromFile
 	FEmulatorThreaded(UNesComponent* InNesComponent, const FNesSettings& InSettings);
 	~FEmulatorThreaded();
 
@@ -35,14 +41,54 @@ public:
 	virtual void Stop() override;
 
 	void PowerOff();
-protected:
 
 #if NES_SUPPORT_MULTIPLE_INSTANCES
+	// Guards Nestopia's static machine and file callbacks, which are set per instance before loading or running a frame
 	static FCriticalSection CoreCriticalSection;
 #endif
-	// Reference to the most recent task graph entry for the nes game object callback
-	// TODO This should probably be an array if NES_SYNC_THREADS is 0
-	FGraphEventRef LastFrameCallbackTask;
+
+	/* Sets up the unfiltered render state every emulator in the plugin uses, 32-bit RGBA pixels by default.
+	 * With bIndexed the core writes 16-bit pixels whose masks turn the index encoding palette back into the palette index.
+	 */
+	static void ApplyRenderState(Nes::Emulator& Emulator, const FNesSettings& Settings, bool bIndexed = false);
+
+	// Points Nestopia's static machine and file callbacks at nothing, for emulators that aren't an FEmulatorThreaded. Callers hold CoreCriticalSection
+	static void UnsetCallbacks();
+
+	/* Helpers for headless emulators (batch environments, state searches, tests). Loading, unloading and restoring
+	 * states fire the static callbacks, so each of them unsets the callbacks and holds CoreCriticalSection while it runs.
+	 * A restore fires them when it switches the machine's region or resets it after failing halfway.
+	 */
+	// Loads Rom and powers the machine on in NTSC mode with a pad in port 1
+	static Nes::Result LoadHeadless(Nes::Emulator& Emulator, istream& Rom);
+	static void UnloadHeadless(Nes::Emulator& Emulator);
+	static Nes::Result LoadStateHeadless(Nes::Emulator& Emulator, const TArray<uint8>& State);
+
+	// Serializes the machine state into OutState. Doesn't fire any callbacks, so it needs no lock
+	static Nes::Result SaveStateToArray(Nes::Emulator& Emulator, TArray<uint8>& OutState, Nes::Machine::Compression Compression);
+
+	/* Replaces the machine's palette with one that encodes each entry's index in the red and green channels and returns
+	 * the real colors in OutPaletteColors. Returns false, leaving the default palette, if the core alters the encoding.
+	 */
+	static bool SetupIndexedPalette(Nes::Emulator& Emulator, TArray<FColor>& OutPaletteColors);
+
+	// Stops the emulation thread without powering the machine off, so its state can still be saved
+	void StopThread();
+
+	// Creates the filter, generates the palette and applies the sound settings ahead of the first PlayFromFile
+	void Prewarm();
+
+	// True if this is an unattached instance whose buffers fit InSettings
+	bool CanAttach(const FNesSettings& InSettings) const;
+	void AttachComponent(UNesComponent* InNesComponent, const FNesSettings& InSettings);
+
+	// Serializes the full machine state (including battery RAM) into a compressed blob. The thread must be stopped
+	bool SaveMachineState(TArray<uint8>& OutState);
+protected:
+
+	// Cleared by the destructor on the game thread. Frame tasks still queued there check it before touching this instance,
+	// so the thread never has to wait for them to run
+	TSharedRef<bool, ESPMode::ThreadSafe> AliveFlag = MakeShared<bool, ESPMode::ThreadSafe>(true);
 	FRunnableThread* Thread;
 
 	FNesSettings NesSettings;
@@ -63,10 +109,25 @@ protected:
 	
 	double StartTime = 0;
 	int32 FrameNumber = 0;
+
+	// Frames executed by the core, read from the game thread for UNesComponent::GetFrameStats
+	FThreadSafeCounter NumFramesRun;
 	long double FrameExecuteRate = 1.0 / 60.0;
 
+	// Insights scope names carrying the component's name, since the stat cycle counters add up every instance
+	FString ExecuteTraceName;
+	FString HandoffTraceName;
+
+	void SetTraceNames();
+
 	// Begin emulator
+	// Points Nestopia's static machine and file callbacks at this instance. Callers hold CoreCriticalSection
 	void SetCallbacks();
+	void ApplySoundSettings();
+
+	// Points the video, sound and input contexts at this instance's buffers and state. Nestopia's static lock and poll
+	// callbacks are left unset so instances don't have to share them
+	void PrepareOutputs();
 
 	static void NST_CALLBACK DoFileIO(Nes::User::UserData data, Nes::User::File& context)
 	{
@@ -111,81 +172,67 @@ protected:
 		}
 	}
 
-	static bool NST_CALLBACK PollZapper(Nes::Input::UserData data, Nes::Input::Controllers::Zapper& zapper)
-	{
-		if (FEmulatorThreaded* NesThread = (FEmulatorThreaded*)data)
-		{
+protected:
+	
+	// Where frames go when no staging buffer is free, sized for RGBA
+	TArray<uint8> VideoBuffer;
 
-			zapper.fire = NesThread->bFireZapper;
+	// Copy of the last frame emulated, used to find the rows that changed
+	TArray<uint8> PreviousVideoBuffer;
 
-			if (false)
-			{
-				zapper.fire = true;
-				zapper.x = ~0U;
-				zapper.y = ~0U;
-			}
-			else if (zapper.x != ~0U)
-			{
-				zapper.x = NesThread->ZapperX;
-				zapper.y = NesThread->ZapperY;
-			}
-			else if (zapper.fire)
-			{
-				zapper.x = ~1U;
-			}
-		}
-		return true;
-	}
+	// Rows that changed since the last frame handed off to the component
+	FNesDirtyRows DirtyRows;
 
-	static bool NST_CALLBACK PollPad(Nes::Input::UserData data, Nes::Input::Controllers::Pad& pad, unsigned int index)
-	{
-		if (FEmulatorThreaded* NesThread = (FEmulatorThreaded*)data)
-		{
-			//FScopeLock PadsAccessLock(&NesThread->PadsAccessCriticalSection);
-			pad.buttons = NesThread->PadButtons[index];
-		}
-		return true;
-	}
+	// Set when a frame handed off was never presented, the next frame is then uploaded in full
+	FThreadSafeBool bAllRowsDirty;
 
-	static bool NST_CALLBACK AudioLock(Nes::Sound::UserData data, Nes::Sound::Output& output)
-	{
-		if (FEmulatorThreaded * NesThread = (FEmulatorThreaded*)data)
-		{
-			ensureMsgf(&NesThread->SoundOutput == &output, TEXT("NES thread did not match audio output buffer. This is most likely caused by having two NesComponents in the same level, please enable NES_SUPPORT_MULTIPLE_INSTANCES"));
+	// Flags the rows of Current, the frame just emulated, that differ from the previous one
+	void UpdateDirtyRows(const uint8* Current);
 
-			output.samples[0] = NesThread->AudioBuffer.GetData();
-			output.length[0] = NesThread->NumSamplesRequested;
+	// True if frames are handed off as 16-bit palette indices, see FNesSettings::bIndexedVideo
+	bool bVideoIndexed = false;
+
+	// The machine's real palette, captured before it is replaced with the index encoding palette
+	TArray<FColor> PaletteColors;
 
-			output.samples[1] = NULL;
-			output.length[1] = 0;
-		}
-		return true;
-	}
 
-	static void NST_CALLBACK AudioUnlock(Nes::Sound::UserData data, Nes::Sound::Output& Output)
+	// Bytes per frame, 16-bit palette indices or 32-bit RGBA
+	int32 GetFrameSize() const
 	{
+		return NesSettings.ScreenWidth * NesSettings.ScreenHeight * (bVideoIndexed ? sizeof(uint16) : 4);
 	}
 
-	static bool NST_CALLBACK ScreenLock(Nes::Video::UserData data, Nes::Video::Output& output)
-	{
-		if (FEmulatorThreaded* NesThread = (FEmulatorThreaded*)data)
-		{
-			ensureMsgf(&NesThread->VideoOutput == &output, TEXT("NES thread did not match audio output buffer. This is most likely caused by having two NesComponents in the same level, please enable NES_SUPPORT_MULTIPLE_INSTANCES"));
+	// Where the core renders the current frame, a staging buffer or VideoBuffer
+	uint8* VideoTarget = nullptr;
 
-			output.pixels = NesThread->VideoBuffer.GetData();
-			output.pitch = NesThread->NesSettings.ScreenWidth * 4;
-		}
-		return true;
-	}
+	// The component uploader's staging buffers, set from the game thread
+	FNesStagingPoolPtr StagingPool;
+	FCriticalSection StagingPoolCriticalSection;
 
-	static void NST_CALLBACK ScreenUnlock(Nes::Video::UserData data, Nes::Video::Output&)
-	{
-	}
+	FNesStagingPoolPtr GetStagingPool();
 
-protected:
-	
-	TArray<uint8> VideoBuffer;
+	// 16-bit samples rendered by the core, interleaved when NesSettings.bStereo is set
+	TArray<int16> SampleBuffer;
+
+	// SampleBuffer converted to the float format the audio mixer consumes
 	TArray<uint8> AudioBuffer;
+
+	void ConvertSamplesToFloat();
+
+	// Copy of the 2 KB of CPU RAM after the last frame, only filled while bCaptureRam is set
+	TArray<uint8> RamBuffer;
+
+	struct FPendingCheat
+	{
+		Nes::Cheats::Code Code;
+		// If true all codes are removed instead of Code being added
+		bool bClear = false;
+	};
+
+	// Cheat changes requested from the game thread, applied in order before the next frame
+	TQueue<FPendingCheat, EQueueMode::Mpsc> PendingCheats;
+
+	void ApplyPendingCheats();
 	
 	Nes::Video::Output VideoOutput;
 	Nes::Sound::Output SoundOutput;
@@ -204,6 +251,27 @@ public:
 	unsigned int ZapperY = 0;
 	bool bFireZapper = false;
 
-	Nes::Result PlayFromFile(FString FileName);
+	// If true the CPU RAM is handed to the component with every frame, for UNesComponent's RAM search
+	bool bCaptureRam = false;
+
+	// Queues a RAM cheat, Nestopia patches reads of Address to return Value
+	void AddCheatCode(uint16 Address, uint8 Value);
+	void ClearCheatCodes();
+
+	// Loads and powers on the game, then restores InitialState if given before the first frame is run
+	Nes::Result PlayFromFile(FString FileName, const TArray<uint8>* InitialState = nullptr);
+
+	// Frames are written straight into InPool's buffers from now on
+	void SetStagingPool(const FNesStagingPoolPtr& InPool);
+
+	// Makes the next frame handed off carry every row, for when the screen no longer holds what the emulator last sent
+	void MarkAllRowsDirty() { bAllRowsDirty = true; }
+
+	// True between PlayFromFile and PowerOff
+	bool IsRunning() const { return bIsRunning; }
+
+	bool IsVideoIndexed() const { return bVideoIndexed; }
+	int32 GetNumFramesRun() const { return NumFramesRun.GetValue(); }
+	const TArray<FColor>& GetPaletteColors() const { return PaletteColors; }
 	Nes::Result ExecuteFrame(bool bOutputVideo);
 };
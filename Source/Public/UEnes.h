@@ -4,10 +4,13 @@
 
 #include "CoreMinimal.h"
 #include "Modules/ModuleManager.h"
+#include "Stats/Stats.h"
 #include "UEnes.generated.h"
 
 // If non-zero, it will be possible to have more than one emulator in a level. Because Nestopia's callback references aren't
-// instanced, each emulator thread will have to lock the staic core mutex before running its frame update. This could slow things down!
+// instanced, FEmulatorThreaded::CoreCriticalSection is held while a game is loaded, powered or has a state restored, and around
+// each emulator thread's frame execution. Frame post processing runs outside of it, and batch environments and state searches
+// only take it to load, power and restore their instances, never while running frames.
 #define NES_SUPPORT_MULTIPLE_INSTANCES 1
 
 // If non-zero, the NES emulator thread will wait for its corresponding NesComponent to consume the written frame data before executing another frame.
@@ -21,6 +24,10 @@ DECLARE_LOG_CATEGORY_EXTERN(LogUEnesTiming, Verbose, All);
 DECLARE_LOG_CATEGORY_EXTERN(LogUEnesAudio, Verbose, All);
 DECLARE_LOG_CATEGORY_EXTERN(LogUEnesVideo, Verbose, All);
 
+// stat UEnes. Cycle counters add up every instance and only show up as CPU trace scopes in Unreal Insights with stat named
+// events enabled (-statnamedevents). Execute, handoff and frame ready also have trace scopes named after each component
+DECLARE_STATS_GROUP(TEXT("UEnes"), STATGROUP_UEnes, STATCAT_Advanced);
+
 USTRUCT(BlueprintType)
 struct FNesSettings
 {
@@ -32,6 +39,17 @@ struct FNesSettings
 	UPROPERTY(BlueprintReadOnly, EditAnywhere)
 	int32 FramesPerSecond = 60;
 
+	// If true the core renders interleaved two channel audio using Nestopia's pseudo stereo speaker mode
+	UPROPERTY(BlueprintReadOnly, EditAnywhere)
+	bool bStereo = false;
+
+	/* If true frames are handed off as 16-bit palette indices (R16_UINT screen texture) and the colors are provided separately
+	 * through the component's PaletteTexture. The core writes the indices directly, halving both the frame the emulator
+	 * thread fills and the upload. The screen material has to do the palette lookup.
+	 */
+	UPROPERTY(BlueprintReadOnly, EditAnywhere, AdvancedDisplay)
+	bool bIndexedVideo = false;
+
 	// Nestopia requires specific screen dimensions for use with specific filters, so don't expose to user
 	int32 ScreenWidth = 256;
 	int32 ScreenHeight = 240;
@@ -39,6 +57,14 @@ struct FNesSettings
 	// Audio params will be initialized to the appropriate values at runtime
 	int32 SampleRate;
 	int32 SamplesPerFrame;
+
+	// Fills in SampleRate and SamplesPerFrame from the platform's audio settings
+	void InitializeAudioSettings();
+
+	int32 GetNumAudioChannels() const
+	{
+		return bStereo ? 2 : 1;
+	}
 };
 
 class FUEnesModule : public IModuleInterface